@@ -0,0 +1,490 @@
+// Benchmark harness for the mavalloc algorithms and libc malloc
+//
+// usage: bench [-a ALLOCATOR] [-w WORKLOAD] [-s SIZES] [-n BLOCKS]
+//              [-i REPLACEMENTS] [-r REPETITIONS] [-W WARMUP] [-t THREADS] [-x ARENA_SIZE]
+//              [-F FLAGS] [-S SEED] [-p] [-o csv|json]
+//
+//   -a  malloc, first, next, best, worst, adaptive or all (default all)
+//   -w  lifetimes: lifo, fifo, random, longtail or pattern (default pattern)
+//   -s  sizes: fixed:N, uniform:MIN:MAX, powerlaw:MIN:MAX:ALPHA,
+//       bimodal:SMALL:LARGE:FRACTION or histogram:SIZE=WEIGHT,...
+//       (default fixed:10)
+//   -n  live blocks, shared out between the threads (default 5000)
+//   -i  replacements per thread after filling (default 4 per live block)
+//   -r  timed repetitions (default 20), -W untimed warm up ones (default 2)
+//   -t  threads working on the arena at once (default 1)
+//   -x  arena size in bytes (default 64 MB)
+//   -F  comma separated arena flags: huge, quick, large, mmap
+//   -S  seed of the workloads (default 1)
+//   -p  also print a row per phase: fill, steady and drain (one thread only)
+//
+// Every thread replays its own workload from workload.h, generated once up
+// front from the seed and its thread number. Every repetition starts from
+// a fresh arena. The time per operation of
+// each repetition is taken with CLOCK_MONOTONIC, and the mean, standard
+// deviation and 95% confidence interval of the mean over the repetitions
+// are printed, one row or object per allocator.
+//
+// With one thread the hardware counters of perf_counters.h run around each
+// phase of the workload: filling the slots, the replacements and draining
+// them again. Cycles, instructions, L1 data cache, last level cache and
+// dTLB misses and mispredicted branches are printed per operation, -1 for
+// the ones the machine or the kernel will not count and for every one when
+// several threads run.
+#define _GNU_SOURCE
+#include "mavalloc.h"
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "perf_counters.h"
+#include "workload.h"
+
+// default replacements per live block
+#define ROUNDS 4
+// most bytes of a block written after it is allocated
+#define TOUCH_BYTES 16
+#define MAX_REPETITIONS 1000
+
+// the parts of a repetition measured apart, PHASE_ALL is all of them
+enum PHASE
+{
+	PHASE_ALL,
+	PHASE_FILL,
+	PHASE_STEADY,
+	PHASE_DRAIN,
+	PHASES
+};
+
+static const char *phase_names[] = { "all", "fill", "steady", "drain" };
+
+struct allocator
+{
+	const char *name;
+	int libc;
+	enum ALGORITHM algorithm;
+};
+
+static const struct allocator allocators[] = {
+	{ "malloc", 1, FIRST_FIT },
+	{ "first_fit", 0, FIRST_FIT },
+	{ "next_fit", 0, NEXT_FIT },
+	{ "best_fit", 0, BEST_FIT },
+	{ "worst_fit", 0, WORST_FIT },
+	{ "adaptive", 0, ADAPTIVE },
+};
+#define NUM_ALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+// the command line
+static struct workload_config config = { .sizes = SIZES_FIXED, .min = 10, .max = 10,
+                                          .lifetime = LIFETIME_PATTERN, .replacements = -1, .seed = 1 };
+static const char *workload_arg = "pattern";
+static const char *sizes_arg = "fixed:10";
+static int blocks = 5000;
+static int repetitions = 20;
+static int warmup = 2;
+static int threads = 1;
+static size_t arena_size = 64 << 20;
+static int arena_flags = 0;
+static int json = 0;
+static int phases = 0;
+
+// set while a repetition runs against malloc
+static int use_libc;
+
+// one thread's share of a repetition
+struct worker
+{
+	pthread_t thread;
+	pthread_barrier_t *start;
+	struct workload workload;
+	void **slots;
+	long ops;
+	long failures;
+	long long begin; // when the worker got past the barrier and finished
+	long long end;
+};
+
+// what one phase of a repetition took
+struct phase_result
+{
+	long ops;
+	long failures;
+	long long ns;
+	int64_t events[PERF_EVENTS];
+};
+
+static int rows;
+
+// 95% two sided Student t quantiles for 1..30 degrees of freedom
+static const double t_quantile[] = {
+	12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+	2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+	2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// allocates a block into slot i and writes to it, NULL on failure
+static void alloc_slot(struct worker *w, int i, size_t size)
+{
+	void *block = use_libc ? malloc(size) : mavalloc_alloc(size);
+	w->ops++;
+	w->slots[i] = block;
+	if (block == NULL)
+		w->failures++;
+	else
+		memset(block, 'x', size < TOUCH_BYTES ? size : TOUCH_BYTES);
+}
+
+static void free_slot(struct worker *w, int i)
+{
+	if (w->slots[i] == NULL)
+		return;
+	if (use_libc)
+		free(w->slots[i]);
+	else
+		mavalloc_free(w->slots[i]);
+	w->ops++;
+	w->slots[i] = NULL;
+}
+
+static void run_ops(struct worker *w, size_t from, size_t to)
+{
+	for (size_t k = from; k < to; k++)
+	{
+		const struct workload_op *op = &w->workload.ops[k];
+		if (op->op == WORKLOAD_ALLOC)
+			alloc_slot(w, op->slot, op->size);
+		else
+			free_slot(w, op->slot);
+	}
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	pthread_barrier_wait(w->start);
+	w->begin = now_ns();
+	run_ops(w, 0, w->workload.count);
+	w->end = now_ns();
+	return NULL;
+}
+
+// runs a single worker on the calling thread, a phase at a time with the
+// counters around each one. Every workload fills its slots first and
+// frees them all last
+static void run_phases(struct worker *w, struct perf_counters *pc, struct phase_result *results)
+{
+	size_t bounds[] = { 0, w->workload.slots, w->workload.count - w->workload.slots, w->workload.count };
+	for (int p = PHASE_FILL; p < PHASES; p++)
+	{
+		struct phase_result *r = &results[p];
+		long ops = w->ops;
+		long failures = w->failures;
+		perf_counters_start(pc);
+		long long begin = now_ns();
+		run_ops(w, bounds[p - PHASE_FILL], bounds[p - PHASE_FILL + 1]);
+		long long end = now_ns();
+		perf_counters_stop(pc, r->events);
+		r->ops = w->ops - ops;
+		r->failures = w->failures - failures;
+		r->ns = end - begin;
+
+		results[PHASE_ALL].ops += r->ops;
+		results[PHASE_ALL].failures += r->failures;
+		results[PHASE_ALL].ns += r->ns;
+		for (int e = 0; e < PERF_EVENTS; e++)
+		{
+			int64_t *all = &results[PHASE_ALL].events[e];
+			*all = r->events[e] < 0 || *all < 0 ? -1 : *all + r->events[e];
+		}
+	}
+}
+
+// runs one repetition and fills in a result per phase, returns -1 if the
+// arena could not be set up. The workers read the clock themselves, the
+// calling thread may not get to run again until they are done
+static int run_repetition(const struct allocator *a, struct worker *workers,
+                          struct perf_counters *pc, struct phase_result *results)
+{
+	pthread_barrier_t start;
+	use_libc = a->libc;
+	if (!use_libc && mavalloc_init_flags(arena_size, a->algorithm, arena_flags) != 0)
+		return -1;
+	memset(results, 0, PHASES * sizeof(struct phase_result));
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].ops = 0;
+		workers[t].failures = 0;
+		workers[t].start = &start;
+	}
+
+	if (threads == 1)
+	{
+		run_phases(&workers[0], pc, results);
+	}
+	else
+	{
+		pthread_barrier_init(&start, NULL, threads);
+		for (int t = 0; t < threads; t++)
+			pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+		for (int t = 0; t < threads; t++)
+			pthread_join(workers[t].thread, NULL);
+		pthread_barrier_destroy(&start);
+
+		// from the first worker starting to the last one finishing
+		struct phase_result *all = &results[PHASE_ALL];
+		long long begin = workers[0].begin;
+		long long end = workers[0].end;
+		for (int t = 0; t < threads; t++)
+		{
+			begin = workers[t].begin < begin ? workers[t].begin : begin;
+			end = workers[t].end > end ? workers[t].end : end;
+			all->ops += workers[t].ops;
+			all->failures += workers[t].failures;
+		}
+		all->ns = end - begin;
+		for (int e = 0; e < PERF_EVENTS; e++)
+			all->events[e] = -1;
+	}
+	if (!use_libc)
+		mavalloc_destroy();
+	return 0;
+}
+
+static void print_row(const struct allocator *a, int phase, long ops, double mean, double stddev,
+                      double half_width, long failures, const double *per_op)
+{
+	if (json)
+	{
+		printf("%s  {\"allocator\": \"%s\", \"phase\": \"%s\", \"workload\": \"%s\", "
+		       "\"sizes\": \"%s\", \"blocks\": %d, \"threads\": %d, \"repetitions\": %d, "
+		       "\"ops\": %ld, \"mean_ns_per_op\": %.3f, \"stddev_ns_per_op\": %.3f, "
+		       "\"ci95_low\": %.3f, \"ci95_high\": %.3f, \"ops_per_sec\": %.0f, \"failures\": %ld",
+		       rows ? ",\n" : "", a->name, phase_names[phase], workload_arg, sizes_arg, blocks,
+		       threads, repetitions, ops, mean, stddev, mean - half_width, mean + half_width,
+		       mean > 0 ? 1e9 / mean : 0.0, failures);
+		for (int e = 0; e < PERF_EVENTS; e++)
+			printf(", \"%s_per_op\": %.4f", perf_event_names[e], per_op[e]);
+		printf("}");
+	}
+	else
+	{
+		printf("%s,%s,%s,%s,%d,%d,%d,%ld,%.3f,%.3f,%.3f,%.3f,%.0f,%ld",
+		       a->name, phase_names[phase], workload_arg, sizes_arg, blocks, threads, repetitions, ops,
+		       mean, stddev, mean - half_width, mean + half_width, mean > 0 ? 1e9 / mean : 0.0, failures);
+		for (int e = 0; e < PERF_EVENTS; e++)
+			printf(",%.4f", per_op[e]);
+		printf("\n");
+	}
+	rows++;
+}
+
+// runs the warm up and timed repetitions against one allocator and prints
+// the summary of every phase asked for
+static void run(const struct allocator *a, struct worker *workers, struct perf_counters *pc)
+{
+	static double ns_per_op[PHASES][MAX_REPETITIONS];
+	struct phase_result totals[PHASES];
+	memset(totals, 0, sizeof(totals));
+
+	for (int r = 0; r < warmup + repetitions; r++)
+	{
+		struct phase_result results[PHASES];
+		if (run_repetition(a, workers, pc, results) != 0)
+		{
+			fprintf(stderr, "bench: %s: init failed\n", a->name);
+			return;
+		}
+		if (r < warmup)
+			continue;
+		for (int p = 0; p < PHASES; p++)
+		{
+			struct phase_result *total = &totals[p];
+			ns_per_op[p][r - warmup] = results[p].ops ? (double)results[p].ns / results[p].ops : 0.0;
+			total->ops = results[p].ops;
+			total->failures += results[p].failures;
+			for (int e = 0; e < PERF_EVENTS; e++)
+			{
+				int64_t count = results[p].events[e];
+				total->events[e] = count < 0 || total->events[e] < 0 ? -1 : total->events[e] + count;
+			}
+		}
+	}
+
+	for (int p = 0; p < (phases ? PHASES : PHASE_ALL + 1); p++)
+	{
+		double *ns = ns_per_op[p];
+		double mean = 0.0;
+		for (int r = 0; r < repetitions; r++)
+			mean += ns[r];
+		mean /= repetitions;
+		double variance = 0.0;
+		for (int r = 0; r < repetitions; r++)
+			variance += (ns[r] - mean) * (ns[r] - mean);
+		double stddev = repetitions > 1 ? sqrt(variance / (repetitions - 1)) : 0.0;
+		double t = repetitions - 1 <= 30 ? t_quantile[repetitions > 1 ? repetitions - 2 : 0] : 1.96;
+		double half_width = repetitions > 1 ? t * stddev / sqrt(repetitions) : 0.0;
+
+		double per_op[PERF_EVENTS];
+		double ops = (double)totals[p].ops * repetitions;
+		for (int e = 0; e < PERF_EVENTS; e++)
+			per_op[e] = totals[p].events[e] < 0 ? -1.0 : ops > 0 ? totals[p].events[e] / ops : 0.0;
+		print_row(a, p, totals[p].ops, mean, stddev, half_width, totals[p].failures, per_op);
+	}
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-a ALLOCATOR] [-w WORKLOAD] [-s SIZES] [-n BLOCKS]\n"
+	                "       [-i REPLACEMENTS] [-r REPETITIONS] [-W WARMUP] [-t THREADS] [-x ARENA_SIZE]\n"
+	                "       [-F FLAGS] [-S SEED] [-p] [-o csv|json]\n", name);
+	exit(1);
+}
+
+static int parse_flags(char *arg)
+{
+	int flags = 0;
+	for (char *flag = strtok(arg, ","); flag != NULL; flag = strtok(NULL, ","))
+	{
+		if (strcmp(flag, "huge") == 0)
+			flags |= MAVALLOC_HUGEPAGES;
+		else if (strcmp(flag, "quick") == 0)
+			flags |= MAVALLOC_QUICKFIT;
+		else if (strcmp(flag, "large") == 0)
+			flags |= MAVALLOC_LARGE;
+		else if (strcmp(flag, "mmap") == 0)
+			flags |= MAVALLOC_MMAP;
+		else
+			return -1;
+	}
+	return flags;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *allocator = "all";
+	int opt;
+	while ((opt = getopt(argc, argv, "a:w:s:n:i:r:W:t:x:F:S:po:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				allocator = optarg;
+				break;
+			case 'w':
+				workload_arg = optarg;
+				if (workload_parse_lifetime(optarg, &config) != 0)
+					usage(argv[0]);
+				break;
+			case 's':
+				sizes_arg = optarg;
+				if (workload_parse_sizes(optarg, &config) != 0)
+					usage(argv[0]);
+				break;
+			case 'n':
+				blocks = atoi(optarg);
+				break;
+			case 'i':
+				config.replacements = atol(optarg);
+				break;
+			case 'r':
+				repetitions = atoi(optarg);
+				break;
+			case 'W':
+				warmup = atoi(optarg);
+				break;
+			case 't':
+				threads = atoi(optarg);
+				break;
+			case 'x':
+				arena_size = strtoull(optarg, NULL, 0);
+				break;
+			case 'F':
+				arena_flags = parse_flags(optarg);
+				if (arena_flags < 0)
+					usage(argv[0]);
+				break;
+			case 'S':
+				config.seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'p':
+				phases = 1;
+				break;
+			case 'o':
+				if (strcmp(optarg, "json") != 0 && strcmp(optarg, "csv") != 0)
+					usage(argv[0]);
+				json = strcmp(optarg, "json") == 0;
+				break;
+			default:
+				usage(argv[0]);
+		}
+	}
+	if (blocks < 1 || threads < 1 || threads > blocks || warmup < 0 ||
+	    repetitions < 1 || repetitions > MAX_REPETITIONS || (phases && threads > 1))
+		usage(argv[0]);
+
+	// every thread gets its own share of the blocks and its own seed
+	struct worker *workers = calloc(threads, sizeof(struct worker));
+	uint64_t seed = config.seed;
+	int rounds = config.replacements < 0;
+	for (int t = 0; t < threads; t++)
+	{
+		config.live = blocks / threads + (t < blocks % threads);
+		config.seed = seed + t;
+		if (rounds)
+			config.replacements = (long)config.live * ROUNDS;
+		if (workload_generate(&config, &workers[t].workload) != 0)
+		{
+			fprintf(stderr, "bench: invalid workload\n");
+			return 1;
+		}
+		workers[t].slots = calloc(workers[t].workload.slots, sizeof(void *));
+	}
+
+	int found = 0;
+	for (int i = 0; i < NUM_ALLOCATORS; i++)
+	{
+		// "first" selects "first_fit" and so on
+		found += strcmp(allocator, "all") == 0 || strncmp(allocator, allocators[i].name, strlen(allocator)) == 0;
+	}
+	if (!found)
+		usage(argv[0]);
+
+	struct perf_counters pc;
+	if (perf_counters_open(&pc) < PERF_EVENTS && threads == 1)
+		fprintf(stderr, "bench: some hardware counters are not available, they read -1\n");
+	if (json)
+	{
+		printf("[\n");
+	}
+	else
+	{
+		printf("allocator,phase,workload,sizes,blocks,threads,repetitions,ops,mean_ns_per_op,"
+		       "stddev_ns_per_op,ci95_low,ci95_high,ops_per_sec,failures");
+		for (int e = 0; e < PERF_EVENTS; e++)
+			printf(",%s_per_op", perf_event_names[e]);
+		printf("\n");
+	}
+	for (int i = 0; i < NUM_ALLOCATORS; i++)
+	{
+		if (strcmp(allocator, "all") != 0 && strncmp(allocator, allocators[i].name, strlen(allocator)) != 0)
+			continue;
+		run(&allocators[i], workers, &pc);
+	}
+	if (json)
+		printf("\n]\n");
+	perf_counters_close(&pc);
+	return 0;
+}
@@ -0,0 +1,60 @@
+// Benchmarks first-touch latency of a fresh arena with and without prefault
+#include "mavalloc.h"
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "parameters.h"
+
+#define FIRST_TOUCH_ALLOCS 4096
+#define FIRST_TOUCH_SIZE 4096
+
+static int compare_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// times the first FIRST_TOUCH_ALLOCS allocations after init, each one
+// including the first write to the block, and prints p50, p99 and max in ns.
+// Next fit keeps allocating from the trailing hole so the search stays short
+static void run(const char *name, int flags)
+{
+	static long long latency[NUM_TESTCASES * FIRST_TOUCH_ALLOCS];
+	int n = 0;
+	for (int testcase = 0; testcase < NUM_TESTCASES; testcase++)
+	{
+		if (mavalloc_init_flags(FIRST_TOUCH_ALLOCS * FIRST_TOUCH_SIZE, NEXT_FIT, flags) != 0)
+		{
+			printf("%s: init failed\n", name);
+			return;
+		}
+		for (int i = 0; i < FIRST_TOUCH_ALLOCS; i++)
+		{
+			long long start = now_ns();
+			char *block = mavalloc_alloc(FIRST_TOUCH_SIZE);
+			memset(block, 'x', FIRST_TOUCH_SIZE);
+			latency[n++] = now_ns() - start;
+		}
+		mavalloc_destroy();
+	}
+	qsort(latency, n, sizeof(latency[0]), compare_ns);
+	printf("%s p50 %lld p99 %lld max %lld\n", name,
+	       latency[n / 2], latency[(int)(n * 0.99)], latency[n - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+	run("mmap", MAVALLOC_MMAP);
+	run("prefault", MAVALLOC_PREFAULT);
+	return 0;
+}
@@ -0,0 +1,83 @@
+// Benchmarks every algorithm, and ADAPTIVE, on a workload that changes shape
+#include "mavalloc.h"
+#include <stdio.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_SIZE (1 << 20)
+#define SLOTS 1000
+#define PHASE_OPS 20000
+#define PHASES 3
+#define STREAM_SIZE 64
+#define MIXED_MAX 2048
+
+static void *slots[SLOTS];
+
+// the stream phases replace the oldest block with one of a fixed size,
+// the mixed phase replaces a random block with one of a random size and
+// fragments the arena. Returns the number of allocations that failed
+static int run_phase(int phase, int *oldest)
+{
+	int failures = 0;
+	for (int op = 0; op < PHASE_OPS; op++)
+	{
+		int slot;
+		size_t size;
+		if (phase == 1)
+		{
+			slot = rand() % SLOTS;
+			size = 16 + rand() % (MIXED_MAX - 16);
+		}
+		else
+		{
+			slot = *oldest;
+			*oldest = (*oldest + 1) % SLOTS;
+			size = STREAM_SIZE;
+		}
+		mavalloc_free(slots[slot]);
+		slots[slot] = mavalloc_alloc(size);
+		if (slots[slot] == NULL)
+			failures++;
+		else
+			memset(slots[slot], 'x', size);
+	}
+	return failures;
+}
+
+// prints the milliseconds each phase took and the failed allocations
+static void run(const char *name, enum ALGORITHM algorithm)
+{
+	double phase_time[PHASES];
+	int failures = 0;
+	int oldest = 0;
+
+	srand(1);
+	mavalloc_init(ARENA_SIZE, algorithm);
+	memset(slots, 0, sizeof(slots));
+	for (int phase = 0; phase < PHASES; phase++)
+	{
+		clock_t start = clock();
+		failures += run_phase(phase, &oldest);
+		phase_time[phase] = 1000 * (double)(clock() - start) / CLOCKS_PER_SEC;
+	}
+	mavalloc_destroy();
+
+	printf("%s", name);
+	for (int phase = 0; phase < PHASES; phase++)
+	{
+		printf(" %lf", phase_time[phase]);
+	}
+	printf(" %d\n", failures);
+}
+
+int main()
+{
+	printf("algorithm stream_ms mixed_ms stream_ms failures\n");
+	run("first_fit", FIRST_FIT);
+	run("next_fit", NEXT_FIT);
+	run("best_fit", BEST_FIT);
+	run("worst_fit", WORST_FIT);
+	run("adaptive", ADAPTIVE);
+	return 0;
+}
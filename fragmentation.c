@@ -0,0 +1,197 @@
+// Benchmarks how each algorithm fragments the arena over a long run
+//
+// usage: fragmentation [-a ALLOCATOR] [-w LIFETIMES] [-s SIZES] [-l LIVE]
+//                      [-n OPS] [-e EVERY] [-x ARENA_SIZE] [-S SEED]
+//                      [-o FILE]
+//
+//   -a  first, next, best, worst, adaptive or all (default all)
+//   -w  lifetime distribution as in bench (default random)
+//   -s  size distribution as in bench (default uniform:16:4096)
+//   -l  live blocks (default 2000)
+//   -n  replacements after filling (default 200000)
+//   -e  operations between two samples (default 1000)
+//   -x  arena size in bytes (default a quarter more than the mean demand)
+//   -S  seed of the workload (default 1)
+//   -o  file to write the time series to (default stdout)
+//
+// Every algorithm replays the same workload. Every EVERY operations the
+// external fragmentation (1 - largest hole / free bytes), the number of
+// holes, the ledger length and the share of the allocations since the
+// last sample that failed are written as a CSV row. A summary of the
+// second half of each run goes to stderr.
+#include "mavalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+struct allocator
+{
+	const char *name;
+	enum ALGORITHM algorithm;
+};
+
+static const struct allocator allocators[] = {
+	{ "first_fit", FIRST_FIT },
+	{ "next_fit", NEXT_FIT },
+	{ "best_fit", BEST_FIT },
+	{ "worst_fit", WORST_FIT },
+	{ "adaptive", ADAPTIVE },
+};
+#define NUM_ALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+static struct workload_config config = { .sizes = SIZES_UNIFORM, .min = 16, .max = 4096,
+                                          .lifetime = LIFETIME_RANDOM, .live = 2000,
+                                          .replacements = 200000, .seed = 1 };
+static struct workload workload;
+static size_t arena_size = 0;
+static long every = 1000;
+static FILE *out;
+
+// replays the workload up to where it starts freeing everything and
+// samples the arena along the way
+static void run(const struct allocator *a, void **slots)
+{
+	long window_allocs = 0;
+	long window_failures = 0;
+	long failures = 0;
+	long allocs = 0;
+	double fragmentation_sum = 0.0;
+	double holes_sum = 0.0;
+	int samples = 0;
+
+	if (mavalloc_init(arena_size, a->algorithm) != 0)
+	{
+		fprintf(stderr, "fragmentation: %s: init failed\n", a->name);
+		return;
+	}
+	memset(slots, 0, workload.slots * sizeof(void *));
+
+	size_t steady = workload.count - config.live;
+	for (size_t k = 0; k < steady; k++)
+	{
+		const struct workload_op *op = &workload.ops[k];
+		if (op->op == WORKLOAD_ALLOC)
+		{
+			slots[op->slot] = mavalloc_alloc(op->size);
+			window_allocs++;
+			window_failures += slots[op->slot] == NULL;
+		}
+		else if (slots[op->slot] != NULL)
+		{
+			mavalloc_free(slots[op->slot]);
+			slots[op->slot] = NULL;
+		}
+
+		if ((k + 1) % every != 0)
+			continue;
+		struct mavalloc_stats stats;
+		mavalloc_stats(&stats);
+		int ledger_length = mavalloc_size();
+		double failure_rate = window_allocs ? (double)window_failures / window_allocs : 0.0;
+		fprintf(out, "%s,%zu,%.4f,%zu,%d,%zu,%zu,%zu,%.4f\n", a->name, k + 1, stats.fragmentation,
+		        stats.holes, ledger_length, stats.bytes_free, stats.largest_hole,
+		        stats.bytes_allocated, failure_rate);
+		if (k >= steady / 2)
+		{
+			fragmentation_sum += stats.fragmentation;
+			holes_sum += stats.holes;
+			samples++;
+		}
+		failures += window_failures;
+		allocs += window_allocs;
+		window_allocs = 0;
+		window_failures = 0;
+	}
+	mavalloc_destroy();
+
+	fprintf(stderr, "%-10s mean fragmentation %.4f, mean holes %.1f, failure rate %.4f\n", a->name,
+	        samples ? fragmentation_sum / samples : 0.0, samples ? holes_sum / samples : 0.0,
+	        allocs ? (double)failures / allocs : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *allocator = "all";
+	const char *path = NULL;
+	int bad = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:w:s:l:n:e:x:S:o:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				allocator = optarg;
+				break;
+			case 'w':
+				bad |= workload_parse_lifetime(optarg, &config) != 0;
+				break;
+			case 's':
+				bad |= workload_parse_sizes(optarg, &config) != 0;
+				break;
+			case 'l':
+				config.live = atoi(optarg);
+				break;
+			case 'n':
+				config.replacements = atol(optarg);
+				break;
+			case 'e':
+				every = atol(optarg);
+				break;
+			case 'x':
+				arena_size = strtoull(optarg, NULL, 0);
+				break;
+			case 'S':
+				config.seed = strtoull(optarg, NULL, 0);
+				break;
+			case 'o':
+				path = optarg;
+				break;
+			default:
+				bad = 1;
+		}
+	}
+	if (bad || every < 1 || workload_generate(&config, &workload) != 0)
+	{
+		fprintf(stderr, "usage: %s [-a ALLOCATOR] [-w LIFETIMES] [-s SIZES] [-l LIVE]\n"
+		                "       [-n OPS] [-e EVERY] [-x ARENA_SIZE] [-S SEED] [-o FILE]\n", argv[0]);
+		return 1;
+	}
+	out = path ? fopen(path, "w") : stdout;
+	if (out == NULL)
+	{
+		perror(path);
+		return 1;
+	}
+
+	// leave a quarter more room than the live blocks need on average
+	if (arena_size == 0)
+	{
+		double total = 0.0;
+		long allocs = 0;
+		for (size_t k = 0; k < workload.count; k++)
+		{
+			if (workload.ops[k].op == WORKLOAD_ALLOC)
+			{
+				total += ALIGN4(workload.ops[k].size);
+				allocs++;
+			}
+		}
+		arena_size = ALIGN4((size_t)(1.25 * config.live * total / allocs));
+	}
+
+	void **slots = calloc(workload.slots, sizeof(void *));
+	fprintf(out, "algorithm,op,fragmentation,holes,ledger_length,free_bytes,largest_hole,live_bytes,failure_rate\n");
+	for (int i = 0; i < NUM_ALLOCATORS; i++)
+	{
+		if (strcmp(allocator, "all") != 0 && strncmp(allocator, allocators[i].name, strlen(allocator)) != 0)
+			continue;
+		run(&allocators[i], slots);
+	}
+	if (out != stdout)
+		fclose(out);
+	workload_free(&workload);
+	return 0;
+}
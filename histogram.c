@@ -0,0 +1,56 @@
+#include "histogram.h"
+#include <string.h>
+
+// bucket of a value. Values from 2^k on, k >= 7, are shifted right by
+// k - 6 so their top 7 bits pick one of the 64 buckets of that power of two
+static int bucket_of(uint64_t value)
+{
+	if(value < (1 << HISTOGRAM_SUB_BITS))
+		return (int) value;
+	int shift = 63 - __builtin_clzll(value) - HISTOGRAM_SUB_BITS + 1;
+	return shift * HISTOGRAM_HALF + (int) (value >> shift);
+}
+
+// highest value that falls in a bucket
+static uint64_t bucket_top(int bucket)
+{
+	if(bucket < (1 << HISTOGRAM_SUB_BITS))
+		return bucket;
+	int shift = bucket / HISTOGRAM_HALF - 1;
+	uint64_t sub = bucket - shift * HISTOGRAM_HALF;
+	return ((sub + 1) << shift) - 1;
+}
+
+void histogram_reset( struct histogram *h )
+{
+	memset(h, 0, sizeof(*h));
+}
+
+void histogram_record( struct histogram *h, uint64_t value )
+{
+	h->counts[bucket_of(value)]++;
+	h->total++;
+	if(value > h->max)
+		h->max = value;
+}
+
+uint64_t histogram_percentile( const struct histogram *h, double percentile )
+{
+	if(h->total == 0)
+		return 0;
+	if(percentile >= 100.0)
+		return h->max;
+	// the rank of the value, counting from 1
+	double exact = percentile / 100.0 * h->total;
+	uint64_t rank = (uint64_t) exact;
+	if(rank < exact || rank < 1)
+		rank++;
+	uint64_t seen = 0;
+	for(int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += h->counts[i];
+		if(seen >= rank)
+			return bucket_top(i) < h->max ? bucket_top(i) : h->max;
+	}
+	return h->max;
+}
@@ -0,0 +1,49 @@
+// High dynamic range histogram of latencies for the benchmarks
+//
+// Values below 128 have a bucket each. Above that every power of two is
+// split into 64 buckets, so a recorded value is off by less than 1.6%
+// whatever its magnitude, and the whole range of uint64_t fits in a few
+// thousand counters.
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stdint.h>
+
+#define HISTOGRAM_SUB_BITS 7
+#define HISTOGRAM_HALF (1 << (HISTOGRAM_SUB_BITS - 1))
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS + 2) * HISTOGRAM_HALF)
+
+struct histogram
+{
+  uint64_t counts[HISTOGRAM_BUCKETS];
+  uint64_t total;
+  uint64_t max;
+};
+
+/**
+ * @brief Empty a histogram
+ *
+ * \param h The histogram
+ **/
+void histogram_reset( struct histogram *h );
+
+/**
+ * @brief Count a value
+ *
+ * \param h The histogram
+ * \param value The value to count
+ **/
+void histogram_record( struct histogram *h, uint64_t value );
+
+/**
+ * @brief Value below which a share of the counted values lie
+ *
+ * \param h The histogram
+ * \param percentile The share in percent, 0 to 100
+ * \return The highest value of the bucket the percentile falls in, the
+ * exact maximum for 100, or 0 if the histogram is empty
+ **/
+uint64_t histogram_percentile( const struct histogram *h, double percentile );
+
+#endif
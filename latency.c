@@ -0,0 +1,233 @@
+// Benchmarks the latency of every single allocation and free
+//
+// usage: latency [-a ALLOCATOR] [-l LIVE,LIVE,...] [-n OPS] [-s SIZES]
+//                [-S SEED]
+//
+//   -a  malloc, first, next, best, worst, adaptive or all (default all)
+//   -l  live block counts to run at, each one gives the ledger a
+//       different length (default 100,1000,5000)
+//   -n  replacements timed at each live block count (default 100000)
+//   -s  size distribution as in bench (default uniform:16:512)
+//   -S  seed of the workloads (default 1)
+//
+// Each run fills the arena with LIVE blocks of a random lifetime workload
+// from workload.h and then times every free and allocation of the
+// replacements with the time stamp counter, minus the cost of reading it.
+// The times go into HDR histograms and p50, p90, p99, p99.9 and the
+// maximum are printed in nanoseconds as CSV, along with the length the
+// ledger had at the end of the run.
+#include "mavalloc.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "histogram.h"
+#include "workload.h"
+
+#define ARENA_SIZE (64 << 20)
+#define MAX_LIVE_COUNTS 16
+// how long the time stamp counter is calibrated against the clock
+#define CALIBRATE_NS 100000000LL
+
+struct allocator
+{
+	const char *name;
+	int libc;
+	enum ALGORITHM algorithm;
+};
+
+static const struct allocator allocators[] = {
+	{ "malloc", 1, FIRST_FIT },
+	{ "first_fit", 0, FIRST_FIT },
+	{ "next_fit", 0, NEXT_FIT },
+	{ "best_fit", 0, BEST_FIT },
+	{ "worst_fit", 0, WORST_FIT },
+	{ "adaptive", 0, ADAPTIVE },
+};
+#define NUM_ALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9, 100.0 };
+#define NUM_PERCENTILES (int)(sizeof(percentiles) / sizeof(percentiles[0]))
+
+static struct workload_config config = { .sizes = SIZES_UNIFORM, .min = 16, .max = 512,
+                                          .lifetime = LIFETIME_RANDOM, .replacements = 100000,
+                                          .seed = 1 };
+static struct histogram alloc_latency;
+static struct histogram free_latency;
+// nanoseconds per tick, and the ticks it takes to read the counter
+static double tick_ns = 1.0;
+static uint64_t tick_overhead;
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// the time stamp counter, fenced so earlier instructions finish first.
+// Elsewhere than x86 the monotonic clock stands in for it
+static inline uint64_t ticks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_lfence();
+	uint64_t t = __rdtsc();
+	_mm_lfence();
+	return t;
+#else
+	return now_ns();
+#endif
+}
+
+// measures the length of a tick and the cheapest back to back read
+static void calibrate()
+{
+	tick_overhead = UINT64_MAX;
+	for (int i = 0; i < 10000; i++)
+	{
+		uint64_t t0 = ticks();
+		uint64_t t1 = ticks();
+		if (t1 - t0 < tick_overhead)
+			tick_overhead = t1 - t0;
+	}
+	long long start_ns = now_ns();
+	uint64_t start = ticks();
+	while (now_ns() - start_ns < CALIBRATE_NS)
+		;
+	tick_ns = (double)(now_ns() - start_ns) / (ticks() - start);
+}
+
+static void print_row(const char *name, int live, int ledger_length, const char *op, const struct histogram *h)
+{
+	printf("%s,%d,%d,%s,%llu", name, live, ledger_length, op, (unsigned long long)h->total);
+	for (int p = 0; p < NUM_PERCENTILES; p++)
+		printf(",%.0f", histogram_percentile(h, percentiles[p]) * tick_ns);
+	printf("\n");
+}
+
+// times the replacements of the workload and prints a row for the
+// allocations and one for the frees
+static void run(const struct allocator *a, const struct workload *w, void **slots)
+{
+	int libc = a->libc;
+	if (!libc && mavalloc_init(ARENA_SIZE, a->algorithm) != 0)
+	{
+		fprintf(stderr, "latency: %s: init failed\n", a->name);
+		return;
+	}
+	histogram_reset(&alloc_latency);
+	histogram_reset(&free_latency);
+	memset(slots, 0, w->slots * sizeof(void *));
+
+	// filling the arena and emptying it again is not timed
+	size_t fill = config.live;
+	size_t steady = w->count - config.live;
+	for (size_t k = 0; k < steady; k++)
+	{
+		const struct workload_op *op = &w->ops[k];
+		uint64_t start;
+		uint64_t elapsed;
+		if (op->op == WORKLOAD_ALLOC)
+		{
+			start = ticks();
+			slots[op->slot] = libc ? malloc(op->size) : mavalloc_alloc(op->size);
+			elapsed = ticks() - start;
+			if (k >= fill)
+				histogram_record(&alloc_latency, elapsed > tick_overhead ? elapsed - tick_overhead : 0);
+		}
+		else
+		{
+			start = ticks();
+			if (libc)
+				free(slots[op->slot]);
+			else
+				mavalloc_free(slots[op->slot]);
+			elapsed = ticks() - start;
+			slots[op->slot] = NULL;
+			histogram_record(&free_latency, elapsed > tick_overhead ? elapsed - tick_overhead : 0);
+		}
+	}
+	int ledger_length = libc ? -1 : mavalloc_size();
+	for (int k = 0; k < w->slots; k++)
+	{
+		if (libc)
+			free(slots[k]);
+	}
+	if (!libc)
+		mavalloc_destroy();
+
+	print_row(a->name, config.live, ledger_length, "alloc", &alloc_latency);
+	print_row(a->name, config.live, ledger_length, "free", &free_latency);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *allocator = "all";
+	int live[MAX_LIVE_COUNTS] = { 100, 1000, 5000 };
+	int num_live = 3;
+	int bad = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:l:n:s:S:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				allocator = optarg;
+				break;
+			case 'l':
+				num_live = 0;
+				for (char *count = strtok(optarg, ","); count != NULL; count = strtok(NULL, ","))
+				{
+					if (num_live == MAX_LIVE_COUNTS || (live[num_live++] = atoi(count)) < 1)
+						bad = 1;
+				}
+				break;
+			case 'n':
+				config.replacements = atol(optarg);
+				break;
+			case 's':
+				bad |= workload_parse_sizes(optarg, &config) != 0;
+				break;
+			case 'S':
+				config.seed = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				bad = 1;
+		}
+	}
+	if (bad || num_live == 0 || config.replacements < 1)
+	{
+		fprintf(stderr, "usage: %s [-a ALLOCATOR] [-l LIVE,LIVE,...] [-n OPS] [-s SIZES] [-S SEED]\n", argv[0]);
+		return 1;
+	}
+
+	calibrate();
+	printf("# %.4f ns per tick, %llu ticks to read the counter\n", tick_ns, (unsigned long long)tick_overhead);
+	printf("allocator,live_blocks,ledger_length,op,count,p50_ns,p90_ns,p99_ns,p99.9_ns,max_ns\n");
+	for (int l = 0; l < num_live; l++)
+	{
+		struct workload w;
+		config.live = live[l];
+		if (workload_generate(&config, &w) != 0)
+		{
+			fprintf(stderr, "latency: invalid workload\n");
+			return 1;
+		}
+		void **slots = calloc(w.slots, sizeof(void *));
+		for (int i = 0; i < NUM_ALLOCATORS; i++)
+		{
+			const struct allocator *a = &allocators[i];
+			if (strcmp(allocator, "all") != 0 && strncmp(allocator, a->name, strlen(allocator)) != 0)
+				continue;
+			run(a, &w, slots);
+		}
+		free(slots);
+		workload_free(&w);
+	}
+	return 0;
+}
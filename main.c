@@ -1,7 +1,15 @@
 #include "mavalloc.h"
+#include "mavalloc_trace.h"
 #include "tinytest.h"
+#include "workload.h"
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 /*
 *
 * TEST CASE 1: Test init and a single allocation
@@ -636,6 +644,1304 @@ int test_case_20()
   return 1;
 }
 
+/*
+*
+* TEST CASE 21: Test batch allocation carves one hole contiguously
+*
+*/
+int test_case_21()
+{
+  mavalloc_init( 65535, FIRST_FIT );
+
+  void * ptrs[64];
+  size_t count = mavalloc_alloc_batch( 64, 10, ptrs );
+
+  // If you failed here not every block of the batch was allocated
+  TINYTEST_EQUAL( count, 64 );
+
+  // If you failed here the batch was not carved back to back
+  for( int i = 1; i < 64; i++ )
+  {
+    TINYTEST_EQUAL( (char*)ptrs[i - 1] + 12, (char*)ptrs[i] );
+  }
+
+  // If you failed here the batch did not leave 64 allocations and a hole
+  TINYTEST_EQUAL( mavalloc_size(), 65 );
+
+  for( int i = 0; i < 64; i++ )
+  {
+    mavalloc_free( ptrs[i] );
+  }
+
+  // If you failed here freeing the batch did not coalesce back to one node
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 22: Test batch allocation falls back when no hole holds the batch
+*
+*/
+int test_case_22()
+{
+  mavalloc_init( 4096, BEST_FIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 1024 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 4 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 1024 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_ASSERT( ptr3 );
+
+  mavalloc_free( ptr1 );
+
+  // 1024 + 2044 bytes are free but no single hole holds 3 x 1024
+  void * ptrs[4];
+  size_t count = mavalloc_alloc_batch( 4, 1024, ptrs );
+
+  // If you failed here the fallback did not fill the holes one at a time
+  TINYTEST_EQUAL( count, 2 );
+  TINYTEST_EQUAL( ptrs[2], NULL );
+  TINYTEST_EQUAL( ptrs[3], NULL );
+
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 23: Test batch free of unsorted pointers coalesces in one pass
+*
+*/
+int test_case_23()
+{
+  mavalloc_init( 65535, FIRST_FIT );
+
+  void * ptrs[100];
+  for( int i = 0; i < 100; i++ )
+  {
+    ptrs[i] = mavalloc_alloc( 40 );
+    TINYTEST_ASSERT( ptrs[i] );
+  }
+
+  // free every other block, back to front
+  void * odd[50];
+  for( int i = 0; i < 50; i++ )
+  {
+    odd[i] = ptrs[99 - 2 * i];
+  }
+  mavalloc_free_batch( odd, 50 );
+
+  // If you failed here the odd blocks were not all turned into holes, the
+  // last one coalesces with the trailing hole
+  TINYTEST_EQUAL( mavalloc_size(), 100 );
+
+  // free the rest shuffled, with a NULL and a duplicate mixed in
+  void * even[52];
+  for( int i = 0; i < 50; i++ )
+  {
+    even[i] = ptrs[( i * 37 ) % 50 * 2];
+  }
+  even[50] = NULL;
+  even[51] = ptrs[0];
+  mavalloc_free_batch( even, 52 );
+
+  // If you failed here the batch free did not coalesce back to one node
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  char * ptr = ( char * ) mavalloc_alloc( 65535 );
+
+  // If you failed here the coalesced hole does not span the whole arena
+  TINYTEST_ASSERT( ptr );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 24: Test sized free releases and coalesces the right block
+*
+*/
+int test_case_24()
+{
+  mavalloc_init( 65535, FIRST_FIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 10 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 300 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 10 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_ASSERT( ptr3 );
+
+  mavalloc_free_sized( ptr2, 300 );
+
+  // If you failed here the sized free did not turn the block into a hole
+  TINYTEST_EQUAL( mavalloc_size(), 4 );
+
+  char * ptr4 = ( char * ) mavalloc_alloc ( 300 );
+
+  // If you failed here the freed block was not reused
+  TINYTEST_EQUAL( ptr2, ptr4 );
+
+  // blocks are looked up by address, the size is ignored, so a wrong
+  // one frees exactly the block at ptr and nothing else
+  mavalloc_free_sized( ptr3, 4000 );
+
+  // If you failed here the wrong size freed the wrong block or none
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr3 ), 0 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr4 ), 300 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr1 ), 12 );
+
+  mavalloc_free_sized( ptr4, 300 );
+  mavalloc_free_sized( ptr1, 10 );
+
+  // If you failed here the sized frees did not coalesce back to one node
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+
+  // large objects are found by their size, or by a scan if the
+  // threshold moved above them since
+  mavalloc_init_flags( 65536, FIRST_FIT, MAVALLOC_LARGE );
+  mavalloc_set_large_threshold( 8192 );
+  char * ptr5 = ( char * ) mavalloc_alloc ( 10000 );
+  char * ptr6 = ( char * ) mavalloc_alloc ( 10000 );
+  TINYTEST_EQUAL( mavalloc_offset( ptr5 ), SIZE_MAX );
+  mavalloc_free_sized( ptr5, 10000 );
+  mavalloc_set_large_threshold( 1 << 20 );
+  mavalloc_free_sized( ptr6, 10000 );
+
+  // If you failed here a large object was not unmapped by a sized free
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr5 ), 0 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr6 ), 0 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 25: Test growing the arena instead of returning NULL
+*
+*/
+int test_case_25()
+{
+  mavalloc_init_flags( 1024, FIRST_FIT, MAVALLOC_GROW );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 1024 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 1024 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 65536 );
+
+  // If you failed here the pool itself could not be used
+  TINYTEST_ASSERT( ptr1 );
+
+  // If you failed here the arena did not grow when it was full
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_ASSERT( ptr3 );
+
+  memset( ptr3, 'x', 65536 );
+
+  mavalloc_free( ptr1 );
+  mavalloc_free( ptr2 );
+  mavalloc_free( ptr3 );
+
+  // If you failed here holes were coalesced across chunks, each of the
+  // three chunks should be left as a single hole
+  TINYTEST_EQUAL( mavalloc_size(), 3 );
+
+  mavalloc_destroy( );
+
+  mavalloc_init( 1024, FIRST_FIT );
+  char * ptr4 = ( char * ) mavalloc_alloc ( 2048 );
+
+  // If you failed here an arena without MAVALLOC_GROW grew
+  TINYTEST_EQUAL( ptr4, NULL );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 26: Test purging holes and zeroing purged memory
+*
+*/
+int test_case_26()
+{
+  mavalloc_init( 1 << 20, FIRST_FIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 1 << 19 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 16 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+
+  memset( ptr1, 0xff, 1 << 19 );
+  mavalloc_free( ptr1 );
+
+  // If you failed here purging ran while it was turned off
+  TINYTEST_EQUAL( mavalloc_purge(), 0 );
+
+  mavalloc_set_decay( 0 );
+
+  // If you failed here the free hole was not purged
+  TINYTEST_ASSERT( mavalloc_purge() > 0 );
+
+  char * ptr3 = ( char * ) mavalloc_calloc ( 1, 1 << 19 );
+
+  // If you failed here calloc did not reuse the purged hole
+  TINYTEST_EQUAL( ptr1, ptr3 );
+
+  // If you failed here calloc skipped clearing bytes that were not purged
+  for( int i = 0; i < ( 1 << 19 ); i++ )
+  {
+    TINYTEST_EQUAL( ptr3[i], 0 );
+  }
+  mavalloc_destroy( );
+
+  mavalloc_init_flags( 1024, FIRST_FIT, MAVALLOC_GROW );
+  mavalloc_set_decay( 0 );
+  char * ptr4 = ( char * ) mavalloc_alloc ( 8192 );
+  TINYTEST_ASSERT( ptr4 );
+
+  // If you failed here the arena did not grow a second chunk
+  TINYTEST_EQUAL( mavalloc_size(), 2 );
+
+  mavalloc_free( ptr4 );
+
+  // If you failed here the empty chunk was not unmapped on free
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+
+  // holes from before decay was turned on wait the whole decay time
+  mavalloc_init( 1 << 20, FIRST_FIT );
+  ptr1 = ( char * ) mavalloc_alloc ( 1 << 19 );
+  ptr2 = ( char * ) mavalloc_alloc ( 16 );
+  mavalloc_free( ptr1 );
+  usleep( 250000 );
+  mavalloc_set_decay( 200 );
+
+  // If you failed here an old hole was purged before its decay time
+  TINYTEST_EQUAL( mavalloc_purge(), 0 );
+  usleep( 250000 );
+  TINYTEST_ASSERT( mavalloc_purge() > 0 );
+  mavalloc_set_decay( -1 );
+  mavalloc_destroy( );
+
+  mavalloc_init_flags( 8192, FIRST_FIT, MAVALLOC_MMAP | MAVALLOC_GROW );
+  mavalloc_set_decay( 0 );
+  char * ptr5 = ( char * ) mavalloc_alloc ( 100 );
+  mavalloc_free( ptr5 );
+  mavalloc_purge( );
+
+  // If you failed here the pool itself was unmapped
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  TINYTEST_EQUAL( mavalloc_pointer( 0 ), ptr5 );
+  ptr5 = ( char * ) mavalloc_alloc ( 8192 );
+  TINYTEST_EQUAL( mavalloc_offset( ptr5 ), 0 );
+  memset( ptr5, 'x', 8192 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 27: Test huge page backed pool aligns huge page sized blocks
+*
+*/
+int test_case_27()
+{
+  int rc = mavalloc_init_flags( 4 << 20, FIRST_FIT, MAVALLOC_HUGEPAGES );
+
+  // If you failed here the pool could not be mapped
+  TINYTEST_EQUAL( rc, 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 100 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 2 << 20 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+
+  // If you failed here the pool is not huge page aligned
+  TINYTEST_EQUAL( (size_t) ptr1 % ( 2 << 20 ), 0 );
+
+  // If you failed here the large block straddles a huge page boundary
+  TINYTEST_EQUAL( (size_t) ptr2 % ( 2 << 20 ), 0 );
+
+  memset( ptr2, 'x', 2 << 20 );
+
+  mavalloc_free( ptr2 );
+  mavalloc_free( ptr1 );
+
+  // If you failed here the alignment padding was not coalesced on free
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 28: Test prefaulted pool is resident right after init
+*
+*/
+int test_case_28()
+{
+  size_t pool = 1 << 20;
+  int rc = mavalloc_init_flags( pool, FIRST_FIT, MAVALLOC_PREFAULT );
+
+  // If you failed here the pool could not be mapped
+  TINYTEST_EQUAL( rc, 0 );
+
+  char * ptr = ( char * ) mavalloc_alloc ( pool );
+  TINYTEST_ASSERT( ptr );
+
+  size_t page = sysconf( _SC_PAGESIZE );
+  unsigned char resident[( 1 << 20 ) / 4096 + 1];
+  rc = mincore( ptr, pool, resident );
+  TINYTEST_EQUAL( rc, 0 );
+
+  // If you failed here a page of the pool was not faulted in by init
+  for( size_t i = 0; i < pool / page; i++ )
+  {
+    TINYTEST_EQUAL( resident[i] & 1, 1 );
+  }
+
+  // If you failed here the prefaulted pool does not read as zero
+  TINYTEST_EQUAL( ptr[pool - 1], 0 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 29: Test NUMA placed arenas
+*
+*/
+int test_case_29()
+{
+  int rc = mavalloc_init_numa( 65536, FIRST_FIT, 0, NUMA_BIND, 0 );
+
+  // If you failed here binding to node 0, which always exists, failed
+  TINYTEST_EQUAL( rc, 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 65536 );
+  TINYTEST_ASSERT( ptr1 );
+  memset( ptr1, 'x', 65536 );
+  mavalloc_destroy( );
+
+  rc = mavalloc_init_numa( 65536, FIRST_FIT, 0, NUMA_BIND, 1 << 20 );
+
+  // If you failed here binding to a node that does not exist succeeded
+  TINYTEST_EQUAL( rc, -1 );
+
+  rc = mavalloc_init_numa( 1 << 20, FIRST_FIT, 0, NUMA_PER_NODE, 0 );
+  TINYTEST_EQUAL( rc, 0 );
+
+  // one hole per node
+  int nodes = mavalloc_size();
+  TINYTEST_ASSERT( nodes >= 1 );
+
+  char * ptr2 = ( char * ) mavalloc_alloc ( 1000 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 1000 );
+
+  // If you failed here the per node arena could not serve allocations
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_ASSERT( ptr3 );
+
+  mavalloc_free( ptr2 );
+  mavalloc_free( ptr3 );
+
+  // If you failed here the node pools were coalesced into each other
+  TINYTEST_EQUAL( mavalloc_size(), nodes );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 30: Test reopening a file backed arena
+*
+*/
+int test_case_30()
+{
+  const char * path = "/tmp/mavalloc_test_case_30.heap";
+  unlink( path );
+
+  int rc = mavalloc_init_file( path, 65536, FIRST_FIT );
+
+  // If you failed here the heap file could not be created
+  TINYTEST_EQUAL( rc, 0 );
+
+  // a two element list linked by offsets
+  size_t * head = ( size_t * ) mavalloc_alloc ( 64 );
+  size_t * tail = ( size_t * ) mavalloc_alloc ( 64 );
+  TINYTEST_ASSERT( head );
+  TINYTEST_ASSERT( tail );
+  head[0] = mavalloc_offset( tail );
+  strcpy( ( char * ) &tail[1], "persisted" );
+  mavalloc_set_root( head );
+
+  int size = mavalloc_size();
+  mavalloc_destroy( );
+
+  // If you failed here the in-memory arena still has the file's ledger
+  TINYTEST_EQUAL( mavalloc_size(), 0 );
+
+  rc = mavalloc_init_file( path, 0, FIRST_FIT );
+
+  // If you failed here the heap file could not be reopened
+  TINYTEST_EQUAL( rc, 0 );
+
+  // If you failed here the ledger did not survive the restart
+  TINYTEST_EQUAL( mavalloc_size(), size );
+
+  head = ( size_t * ) mavalloc_get_root();
+
+  // If you failed here the root was lost
+  TINYTEST_ASSERT( head );
+
+  tail = ( size_t * ) mavalloc_pointer( head[0] );
+
+  // If you failed here the data did not survive the restart
+  TINYTEST_ASSERT( tail );
+  TINYTEST_EQUAL( strcmp( ( char * ) &tail[1], "persisted" ), 0 );
+
+  mavalloc_free( tail );
+  mavalloc_free( head );
+
+  // If you failed here the root was not cleared when its block was freed
+  TINYTEST_EQUAL( mavalloc_get_root(), NULL );
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+
+  // a file that is not a heap is refused
+  FILE * f = fopen( path, "w" );
+  fputs( "not a heap", f );
+  fclose( f );
+  rc = mavalloc_init_file( path, 65536, FIRST_FIT );
+
+  // If you failed here a file that is not a heap was accepted
+  TINYTEST_EQUAL( rc, -1 );
+
+  unlink( path );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 31: Test handing blocks between processes in a shared arena
+*
+*/
+int test_case_31()
+{
+  const char * name = "/mavalloc_test_case_31";
+  shm_unlink( name );
+
+  int rc = mavalloc_init_shared( name, 65536, FIRST_FIT );
+
+  // If you failed here the shared memory object could not be created
+  TINYTEST_EQUAL( rc, 0 );
+
+  size_t * message = ( size_t * ) mavalloc_alloc ( 64 );
+  TINYTEST_ASSERT( message );
+  strcpy( ( char * ) &message[1], "ping" );
+  mavalloc_set_root( message );
+
+  pid_t pid = fork();
+  if( pid == 0 )
+  {
+    // attach to the heap by name like an unrelated process would
+    mavalloc_destroy( );
+    if( mavalloc_init_shared( name, 0, FIRST_FIT ) != 0 )
+      _exit( 1 );
+    size_t * m = ( size_t * ) mavalloc_get_root();
+    if( m == NULL || strcmp( ( char * ) &m[1], "ping" ) != 0 )
+      _exit( 2 );
+    char * reply = ( char * ) mavalloc_alloc ( 64 );
+    if( reply == NULL )
+      _exit( 3 );
+    strcpy( reply, "pong" );
+    m[0] = mavalloc_offset( reply );
+
+    // allocate alongside the parent
+    for( int i = 0; i < 200; i++ )
+      mavalloc_free( mavalloc_alloc ( 32 ) );
+    mavalloc_destroy( );
+    _exit( 0 );
+  }
+  TINYTEST_ASSERT( pid > 0 );
+
+  for( int i = 0; i < 200; i++ )
+    mavalloc_free( mavalloc_alloc ( 48 ) );
+
+  int status;
+  waitpid( pid, &status, 0 );
+
+  // If you failed here the child could not use the shared heap
+  TINYTEST_ASSERT( WIFEXITED( status ) );
+  TINYTEST_EQUAL( WEXITSTATUS( status ), 0 );
+
+  char * reply = ( char * ) mavalloc_pointer( message[0] );
+
+  // If you failed here the child's block did not arrive
+  TINYTEST_ASSERT( reply );
+  TINYTEST_EQUAL( strcmp( reply, "pong" ), 0 );
+
+  // If you failed here the ledger was corrupted by concurrent allocations
+  TINYTEST_EQUAL( mavalloc_size(), 3 );
+
+  mavalloc_free( reply );
+  mavalloc_free( message );
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+  shm_unlink( name );
+
+  // an anonymous heap needs no name
+  rc = mavalloc_init_shared( NULL, 65536, BEST_FIT );
+  TINYTEST_EQUAL( rc, 0 );
+  TINYTEST_ASSERT( mavalloc_alloc ( 1024 ) );
+  TINYTEST_EQUAL( mavalloc_size(), 2 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 32: Test compacting handle blocks
+*
+*/
+int test_case_32()
+{
+  mavalloc_init( 65536, FIRST_FIT );
+
+  int handles[8];
+  for( int i = 0; i < 8; i++ )
+  {
+    handles[i] = mavalloc_halloc ( 8192 );
+    TINYTEST_ASSERT( handles[i] != -1 );
+    char * block = ( char * ) mavalloc_hpin( handles[i] );
+    memset( block, 'a' + i, 8192 );
+    mavalloc_hunpin( handles[i] );
+  }
+
+  // leave eight kilobyte holes between every other block
+  for( int i = 1; i < 8; i += 2 )
+    mavalloc_hfree( handles[i] );
+
+  // If you failed here the fragmented arena still fit a large block
+  TINYTEST_EQUAL( mavalloc_alloc ( 16384 ), NULL );
+
+  // the last block is in use and must stay put
+  char * pinned = ( char * ) mavalloc_hpin( handles[6] );
+
+  // If you failed here an incremental pass moved more than asked
+  TINYTEST_EQUAL( mavalloc_compact( 8192 ), 8192 );
+  while( mavalloc_compact( 8192 ) != 0 )
+    ;
+
+  // If you failed here the pinned block was moved
+  TINYTEST_EQUAL( mavalloc_hpin( handles[6] ), pinned );
+  mavalloc_hunpin( handles[6] );
+
+  // blocks 0 2 4, a 16k hole, pinned block 6 and the last hole
+  TINYTEST_EQUAL( mavalloc_size(), 6 );
+
+  char * large = ( char * ) mavalloc_alloc ( 16384 );
+
+  // If you failed here compaction did not merge the holes
+  TINYTEST_ASSERT( large );
+  mavalloc_free( large );
+
+  mavalloc_hunpin( handles[6] );
+  TINYTEST_EQUAL( mavalloc_compact( 0 ), 8192 );
+
+  // If you failed here the holes did not merge into one
+  TINYTEST_EQUAL( mavalloc_size(), 5 );
+
+  // If you failed here a block lost its contents when it moved
+  for( int i = 0; i < 8; i += 2 )
+  {
+    char * block = ( char * ) mavalloc_hpin( handles[i] );
+    TINYTEST_ASSERT( block );
+    TINYTEST_EQUAL( block[0], 'a' + i );
+    TINYTEST_EQUAL( block[8191], 'a' + i );
+    mavalloc_hunpin( handles[i] );
+  }
+
+  // If you failed here a freed handle was still usable
+  TINYTEST_EQUAL( mavalloc_hpin( handles[1] ), NULL );
+
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 33: Test large objects are mapped outside the pool
+*
+*/
+int test_case_33()
+{
+  mavalloc_init_flags( 1 << 20, FIRST_FIT, MAVALLOC_LARGE );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 512 * 1024 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 4 << 20 );
+  char * ptr3 = ( char * ) mavalloc_calloc ( 1, 300 * 1024 );
+
+  // If you failed here a large object could not be mapped
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_ASSERT( ptr3 );
+
+  // If you failed here a large object was carved from the pool
+  TINYTEST_EQUAL( mavalloc_offset( ptr1 ), SIZE_MAX );
+  TINYTEST_EQUAL( mavalloc_offset( ptr2 ), SIZE_MAX );
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+
+  memset( ptr2, 'x', 4 << 20 );
+  TINYTEST_EQUAL( ptr3[300 * 1024 - 1], 0 );
+
+  size_t page = sysconf( _SC_PAGESIZE );
+  unsigned char resident;
+  mavalloc_free( ptr2 );
+
+  // If you failed here freeing a large object did not unmap it
+  TINYTEST_EQUAL( mincore( ptr2, page, &resident ), -1 );
+
+  mavalloc_free_sized( ptr1, 512 * 1024 );
+  void * ptrs[1] = { ptr3 };
+  mavalloc_free_batch( ptrs, 1 );
+  TINYTEST_EQUAL( mincore( ptr1, page, &resident ), -1 );
+  TINYTEST_EQUAL( mincore( ptr3, page, &resident ), -1 );
+
+  mavalloc_set_large_threshold( 1 << 20 );
+  char * ptr4 = ( char * ) mavalloc_alloc ( 512 * 1024 );
+
+  // If you failed here the threshold was not raised
+  TINYTEST_EQUAL( mavalloc_offset( ptr4 ), 0 );
+  TINYTEST_EQUAL( mavalloc_size(), 2 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 34: Test quick-fit bins reuse small blocks without coalescing
+*
+*/
+int test_case_34()
+{
+  mavalloc_init_flags( 4096, NEXT_FIT, MAVALLOC_QUICKFIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 10 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 10 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 1 );
+  char * ptr4 = ( char * ) mavalloc_alloc ( 3000 );
+
+  TINYTEST_ASSERT( ptr1 );
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_ASSERT( ptr3 );
+  TINYTEST_ASSERT( ptr4 );
+
+  mavalloc_free( ptr1 );
+  mavalloc_free( ptr2 );
+
+  // If you failed here the small blocks were coalesced on free
+  TINYTEST_EQUAL( mavalloc_size(), 5 );
+
+  // If you failed here the bin is not LIFO
+  TINYTEST_EQUAL( mavalloc_alloc ( 12 ), ptr2 );
+  TINYTEST_EQUAL( mavalloc_alloc ( 9 ), ptr1 );
+
+  // If you failed here a block was handed out twice
+  TINYTEST_ASSERT( mavalloc_alloc ( 12 ) != ptr2 );
+
+  mavalloc_free( ptr1 );
+  mavalloc_free( ptr2 );
+  mavalloc_free( ptr3 );
+
+  // If you failed here a double free reached the bin twice
+  mavalloc_free( ptr3 );
+  TINYTEST_EQUAL( mavalloc_alloc ( 4 ), ptr3 );
+  TINYTEST_ASSERT( mavalloc_alloc ( 4 ) != ptr3 );
+  mavalloc_free( ptr3 );
+
+  // large frees still coalesce
+  mavalloc_free( ptr4 );
+
+  // the binned blocks are the only way to fit this
+  char * ptr5 = ( char * ) mavalloc_alloc ( 3000 + 24 );
+
+  // If you failed here the bins were not flushed when nothing fit
+  TINYTEST_EQUAL( ptr5, ptr1 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 35: Test the adaptive algorithm follows fragmentation
+*
+*/
+int test_case_35()
+{
+  static char * blocks[4096];
+  mavalloc_init( 4096 * 256, ADAPTIVE );
+
+  // If you failed here the adaptive arena did not start out as next fit
+  TINYTEST_EQUAL( mavalloc_algorithm(), NEXT_FIT );
+
+  int count = 0;
+  while( count < 4096 && ( blocks[count] = ( char * ) mavalloc_alloc ( 256 ) ) != NULL )
+    count++;
+  TINYTEST_EQUAL( count, 4096 );
+
+  // every other block free leaves the free space in 256 byte pieces
+  for( int i = 0; i < count; i += 2 )
+    mavalloc_free( blocks[i] );
+
+  for( int i = 0; i < 2048 && mavalloc_algorithm() != BEST_FIT; i++ )
+    TINYTEST_EQUAL( mavalloc_alloc ( 512 ), NULL );
+
+  // If you failed here failing searches did not switch to best fit
+  TINYTEST_EQUAL( mavalloc_algorithm(), BEST_FIT );
+
+  for( int i = 1; i < count; i += 2 )
+    mavalloc_free( blocks[i] );
+
+  for( int i = 0; i < 2048 && mavalloc_algorithm() == BEST_FIT; i++ )
+    mavalloc_free( mavalloc_alloc ( 64 ) );
+
+  // If you failed here best fit was kept after the arena was empty again
+  TINYTEST_EQUAL( mavalloc_algorithm(), FIRST_FIT );
+  TINYTEST_EQUAL( mavalloc_size(), 1 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 36: Test statistics stay in step with the ledger
+*
+*/
+int test_case_36()
+{
+  static int handles[512];
+  struct mavalloc_stats stats;
+  mavalloc_init( 65536, WORST_FIT );
+  srand( 36 );
+
+  for( int i = 0; i < 512; i++ )
+    handles[i] = -1;
+
+  for( int op = 0; op < 20000; op++ )
+  {
+    int slot = rand() % 512;
+    if( handles[slot] != -1 )
+    {
+      mavalloc_hfree( handles[slot] );
+      handles[slot] = -1;
+    }
+    else
+    {
+      handles[slot] = mavalloc_halloc ( 4 + rand() % 400 );
+    }
+    if( op % 1000 == 0 )
+      mavalloc_compact( 4096 );
+
+    mavalloc_stats( &stats );
+
+    // If you failed here the counts drifted away from the ledger
+    TINYTEST_EQUAL( stats.holes + stats.live_blocks, mavalloc_size() );
+    TINYTEST_EQUAL( stats.bytes_allocated + stats.bytes_free, 65536 );
+    TINYTEST_ASSERT( stats.high_water >= stats.bytes_allocated );
+  }
+
+  mavalloc_stats( &stats );
+  if( stats.largest_hole > 0 )
+  {
+    // If you failed here the largest hole is not the largest one
+    TINYTEST_EQUAL( mavalloc_alloc ( stats.largest_hole + 4 ), NULL );
+    TINYTEST_ASSERT( mavalloc_alloc ( stats.largest_hole ) );
+  }
+  mavalloc_destroy( );
+
+  mavalloc_init( 4096, FIRST_FIT );
+  char * ptr1 = ( char * ) mavalloc_alloc ( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 1000 );
+  mavalloc_free( ptr1 );
+  mavalloc_stats( &stats );
+  TINYTEST_EQUAL( stats.bytes_allocated, 1000 );
+  TINYTEST_EQUAL( stats.bytes_free, 3096 );
+  TINYTEST_EQUAL( stats.holes, 2 );
+  TINYTEST_EQUAL( stats.live_blocks, 1 );
+  TINYTEST_EQUAL( stats.largest_hole, 2096 );
+  TINYTEST_EQUAL( stats.high_water, 2000 );
+
+  // If you failed here fragmentation is not the free space outside the
+  // largest hole
+  TINYTEST_ASSERT( stats.fragmentation > 0.32 && stats.fragmentation < 0.33 );
+
+  mavalloc_free( ptr2 );
+  mavalloc_stats( &stats );
+  TINYTEST_EQUAL( stats.holes, 1 );
+  TINYTEST_EQUAL( stats.largest_hole, 4096 );
+  TINYTEST_EQUAL( stats.fragmentation, 0.0 );
+  mavalloc_destroy( );
+
+  // flushing the quick bins to make room must not count the binned
+  // blocks as live again
+  mavalloc_init_flags( 8192, FIRST_FIT, MAVALLOC_QUICKFIT );
+  char * small[100];
+  for( int i = 0; i < 100; i++ )
+  {
+    small[i] = ( char * ) mavalloc_alloc ( 32 );
+    TINYTEST_ASSERT( small[i] );
+  }
+  for( int i = 0; i < 100; i++ )
+  {
+    mavalloc_free( small[i] );
+  }
+  TINYTEST_ASSERT( mavalloc_alloc ( 4000 ) );
+  TINYTEST_EQUAL( mavalloc_alloc ( 4100 ), NULL );
+  mavalloc_stats( &stats );
+
+  // If you failed here the flush pushed the high water mark past the peak
+  TINYTEST_EQUAL( stats.bytes_allocated, 4000 );
+  TINYTEST_EQUAL( stats.high_water, 4000 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 37: Test the instrumentation counters
+*
+*/
+int test_case_37()
+{
+  struct mavalloc_counters counters;
+  mavalloc_reset_counters( );
+  mavalloc_init( 4096, FIRST_FIT );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 1000 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 1000 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 1000 );
+  TINYTEST_EQUAL( mavalloc_alloc ( 2000 ), NULL );
+  mavalloc_free( ptr1 );
+  mavalloc_free_sized( ptr2, 4000 );
+  mavalloc_free_sized( ptr3, 1000 );
+
+  int rc = mavalloc_counters( &counters );
+  mavalloc_destroy( );
+
+  // an uninstrumented build only reports that it has no counters
+  if( rc == -1 )
+  {
+    TINYTEST_EQUAL( counters.splits, 0 );
+    return 1;
+  }
+
+  struct mavalloc_search_counters * first = &counters.algorithm[FIRST_FIT];
+
+  // If you failed here searches were not counted for their algorithm
+  TINYTEST_EQUAL( first->searches, 4 );
+  TINYTEST_EQUAL( first->failures, 1 );
+  TINYTEST_EQUAL( counters.algorithm[BEST_FIT].searches, 0 );
+
+  // the three blocks took the front of the hole, the search behind them
+  // walked all four nodes without finding room
+  TINYTEST_EQUAL( first->visits[0], 1 );
+  TINYTEST_EQUAL( first->visits[1], 1 );
+  TINYTEST_EQUAL( first->visits[2], 1 );
+  TINYTEST_EQUAL( first->visits[3], 1 );
+  TINYTEST_EQUAL( first->nodes_visited, 0 + 1 + 2 + 4 );
+
+  TINYTEST_EQUAL( counters.splits, 3 );
+
+  // If you failed here a sized free with the wrong size was not counted
+  TINYTEST_EQUAL( counters.sized_free_mismatches, 1 );
+  TINYTEST_EQUAL( counters.failed_allocations, 1 );
+
+  // ptr2 merges back into ptr1, ptr3 back into both and into the tail
+  TINYTEST_EQUAL( counters.backward_coalesces, 2 );
+  TINYTEST_EQUAL( counters.forward_coalesces, 1 );
+  return 1;
+}
+
+static void * trace_worker( void * arg )
+{
+  for( int i = 0; i < 10; i++ )
+    mavalloc_free( mavalloc_alloc ( 32 ) );
+  return NULL;
+}
+
+/*
+*
+* TEST CASE 38: Test tracing allocations from several threads
+*
+*/
+int test_case_38()
+{
+  const char * path = "/tmp/mavalloc_test_case_38.trace";
+  mavalloc_init( 4096, FIRST_FIT );
+
+  int rc = mavalloc_trace_start( path );
+
+  // If you failed here the trace file could not be created
+  TINYTEST_EQUAL( rc, 0 );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 100 );
+  char * ptr2 = ( char * ) mavalloc_alloc ( 10 );
+  mavalloc_free( ptr1 );
+  TINYTEST_EQUAL( mavalloc_alloc ( 8192 ), NULL );
+
+  // the worker's records are flushed when it exits
+  pthread_t worker;
+  pthread_create( &worker, NULL, trace_worker, NULL );
+  pthread_join( worker, NULL );
+
+  mavalloc_trace_stop( );
+
+  // not recorded any more
+  mavalloc_free( ptr2 );
+  mavalloc_destroy( );
+
+  FILE * f = fopen( path, "rb" );
+  TINYTEST_ASSERT( f );
+  struct mavalloc_trace_header header;
+  TINYTEST_EQUAL( fread( &header, sizeof( header ), 1, f ), 1 );
+
+  // If you failed here the file header is wrong
+  TINYTEST_EQUAL( header.magic, MAVALLOC_TRACE_MAGIC );
+  TINYTEST_EQUAL( header.record_size, sizeof( struct mavalloc_trace_record ) );
+
+  struct mavalloc_trace_record records[32];
+  size_t count = fread( records, sizeof( records[0] ), 32, f );
+  fclose( f );
+  unlink( path );
+
+  // If you failed here events were lost or recorded after the stop
+  TINYTEST_EQUAL( count, 24 );
+
+  // the worker flushed its records when it exited, the main thread's
+  // came out on the stop
+  struct mavalloc_trace_record * worker_records = &records[0];
+  struct mavalloc_trace_record * main_records = &records[20];
+
+  TINYTEST_EQUAL( main_records[0].op, MAVALLOC_TRACE_ALLOC );
+  TINYTEST_EQUAL( main_records[0].size, 100 );
+  TINYTEST_EQUAL( main_records[0].offset, 0 );
+  TINYTEST_EQUAL( main_records[1].offset, 100 );
+  TINYTEST_EQUAL( main_records[2].op, MAVALLOC_TRACE_FREE );
+  TINYTEST_EQUAL( main_records[2].size, 100 );
+  TINYTEST_EQUAL( main_records[2].index, main_records[0].index );
+
+  // If you failed here the failed allocation was not flagged
+  TINYTEST_EQUAL( main_records[3].flags, MAVALLOC_TRACE_FAILED );
+  TINYTEST_EQUAL( main_records[3].nodes_visited, 3 );
+
+  // If you failed here the worker's records were not told apart
+  TINYTEST_ASSERT( worker_records[0].thread != main_records[0].thread );
+  TINYTEST_EQUAL( worker_records[0].op, MAVALLOC_TRACE_ALLOC );
+  TINYTEST_EQUAL( worker_records[1].op, MAVALLOC_TRACE_FREE );
+  TINYTEST_ASSERT( worker_records[0].timestamp_ns >= main_records[3].timestamp_ns );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 39: Test aligned allocations and usable sizes
+*
+*/
+int test_case_39()
+{
+  mavalloc_init_flags( 65536, FIRST_FIT, MAVALLOC_MMAP );
+
+  char * ptr1 = ( char * ) mavalloc_alloc ( 20 );
+  char * ptr2 = ( char * ) mavalloc_alloc_aligned ( 100, 4096 );
+
+  // If you failed here the block was not aligned
+  TINYTEST_ASSERT( ptr2 );
+  TINYTEST_EQUAL( mavalloc_offset( ptr2 ), 4096 );
+
+  // If you failed here the padding in front was not left as a hole
+  TINYTEST_EQUAL( mavalloc_size(), 4 );
+  char * ptr3 = ( char * ) mavalloc_alloc ( 40 );
+  TINYTEST_EQUAL( mavalloc_offset( ptr3 ), 20 );
+
+  // If you failed here a bad alignment was accepted
+  TINYTEST_EQUAL( mavalloc_alloc_aligned( 100, 48 ), NULL );
+
+  // If you failed here the usable size is off
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr1 ), 20 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr2 ), 100 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr2 + 4 ), 0 );
+  TINYTEST_EQUAL( mavalloc_usable_size( &ptr1 ), 0 );
+
+  mavalloc_free( ptr2 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr2 ), 0 );
+
+  // If you failed here an owned free freed what the arena does not own
+  TINYTEST_EQUAL( mavalloc_free_owned( &ptr1 ), 0 );
+  TINYTEST_EQUAL( mavalloc_free_owned( ptr2 ), 0 );
+  TINYTEST_EQUAL( mavalloc_free_owned( ptr1 ), 1 );
+  TINYTEST_EQUAL( mavalloc_usable_size( ptr1 ), 0 );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 40: Test generated workloads against every algorithm
+*
+*/
+int test_case_40()
+{
+  struct workload_config config = { 0 };
+  struct workload w1, w2;
+  static char * slots[500];
+  static size_t sizes[500];
+
+  config.live = 500;
+  config.replacements = 3000;
+  config.seed = 7;
+  TINYTEST_EQUAL( workload_parse_sizes( "powerlaw:8:2048:1.2", &config ), 0 );
+  TINYTEST_EQUAL( workload_parse_lifetime( "longtail", &config ), 0 );
+  TINYTEST_EQUAL( workload_parse_sizes( "histogram:16=1,x", &config ), -1 );
+
+  // If you failed here the same seed gave a different workload
+  TINYTEST_EQUAL( workload_generate( &config, &w1 ), 0 );
+  TINYTEST_EQUAL( workload_generate( &config, &w2 ), 0 );
+  TINYTEST_EQUAL( w1.count, 2 * 500 + 2 * 3000 );
+  TINYTEST_EQUAL( memcmp( w1.ops, w2.ops, w1.count * sizeof( struct workload_op ) ), 0 );
+  workload_free( &w2 );
+
+  for( enum ALGORITHM algorithm = NEXT_FIT; algorithm <= ADAPTIVE; algorithm++ )
+  {
+    mavalloc_init( 2 << 20, algorithm );
+    size_t live = 0;
+    for( size_t k = 0; k < w1.count; k++ )
+    {
+      struct workload_op * op = &w1.ops[k];
+      if( op->op == WORKLOAD_ALLOC )
+      {
+        // If you failed here the generator reused a live slot or drew a
+        // size out of range
+        TINYTEST_EQUAL( slots[op->slot], NULL );
+        TINYTEST_ASSERT( op->size >= 8 && op->size <= 2048 );
+        slots[op->slot] = mavalloc_alloc( op->size );
+        TINYTEST_ASSERT( slots[op->slot] );
+        memset( slots[op->slot], op->slot & 0xff, op->size );
+        sizes[op->slot] = op->size;
+        live += ALIGN4( op->size );
+      }
+      else
+      {
+        // If you failed here a block was overwritten by another one
+        TINYTEST_ASSERT( slots[op->slot] );
+        TINYTEST_EQUAL( slots[op->slot][sizes[op->slot] - 1], (char) ( op->slot & 0xff ) );
+        mavalloc_free( slots[op->slot] );
+        slots[op->slot] = NULL;
+        live -= ALIGN4( sizes[op->slot] );
+      }
+    }
+
+    // If you failed here the workload did not free everything it allocated
+    struct mavalloc_stats stats;
+    mavalloc_stats( &stats );
+    TINYTEST_EQUAL( live, 0 );
+    TINYTEST_EQUAL( stats.live_blocks, 0 );
+    TINYTEST_EQUAL( mavalloc_size(), 1 );
+    mavalloc_destroy( );
+  }
+  workload_free( &w1 );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 41: Test a batch that grows the arena with the ledger nearly full
+*
+*/
+int test_case_41()
+{
+  static void * blocks[10000];
+  void * ptrs[4];
+  mavalloc_init_flags( 65536, FIRST_FIT, MAVALLOC_GROW );
+
+  // leave 4 free ledger slots, growing the arena takes one of them
+  int count = 0;
+  while( count < 9995 && ( blocks[count] = mavalloc_alloc( 4 ) ) != NULL )
+  {
+    count++;
+  }
+  TINYTEST_EQUAL( count, 9995 );
+
+  size_t done = mavalloc_alloc_batch( 4, 8192, ptrs );
+
+  // If you failed here the batch handed out a block the ledger had no
+  // room for
+  TINYTEST_ASSERT( done < 4 );
+  for( size_t i = 0; i < 4; i++ )
+  {
+    if( i < done )
+    {
+      TINYTEST_EQUAL( mavalloc_usable_size( ptrs[i] ), 8192 );
+    }
+    else
+    {
+      TINYTEST_EQUAL( ptrs[i], NULL );
+    }
+  }
+  mavalloc_free_batch( ptrs, done );
+  mavalloc_destroy( );
+
+  // If you failed here a batch of empty blocks divided by zero
+  mavalloc_init( 4096, FIRST_FIT );
+  mavalloc_alloc_batch( 2, 0, ptrs );
+  mavalloc_destroy( );
+  return 1;
+}
+
+/*
+*
+* TEST CASE 42: Test traced search lengths across ADAPTIVE epochs
+*
+*/
+int test_case_42()
+{
+  const char * path = "/tmp/mavalloc_test_case_42.trace";
+  static struct mavalloc_trace_record records[2048];
+  mavalloc_init( 65536, ADAPTIVE );
+  TINYTEST_EQUAL( mavalloc_trace_start( path ), 0 );
+
+  // more searches than an epoch holds, each one failing after walking
+  // the whole ledger
+  for( int i = 0; i < 20; i++ )
+  {
+    TINYTEST_ASSERT( mavalloc_alloc ( 16 ) );
+  }
+  for( int i = 20; i < 1100; i++ )
+  {
+    TINYTEST_EQUAL( mavalloc_alloc ( 100000 ), NULL );
+  }
+  mavalloc_trace_stop( );
+  mavalloc_destroy( );
+
+  FILE * f = fopen( path, "rb" );
+  TINYTEST_ASSERT( f );
+  struct mavalloc_trace_header header;
+  TINYTEST_EQUAL( fread( &header, sizeof( header ), 1, f ), 1 );
+  size_t count = fread( records, sizeof( records[0] ), 2048, f );
+  fclose( f );
+  unlink( path );
+  TINYTEST_EQUAL( count, 1100 );
+
+  // If you failed here the end of an epoch leaked into a search length
+  for( size_t i = 0; i < count; i++ )
+  {
+    TINYTEST_ASSERT( records[i].nodes_visited <= 100 );
+  }
+  return 1;
+}
+
+static volatile int fork_worker_done;
+
+static void * fork_worker( void * arg )
+{
+  while( !fork_worker_done )
+    mavalloc_free( mavalloc_alloc ( 64 ) );
+  return NULL;
+}
+
+/*
+*
+* TEST CASE 43: Test forking while another thread allocates
+*
+*/
+int test_case_43()
+{
+  mavalloc_init( 65536, FIRST_FIT );
+
+  pthread_t worker;
+  fork_worker_done = 0;
+  pthread_create( &worker, NULL, fork_worker, NULL );
+
+  for( int i = 0; i < 20; i++ )
+  {
+    // what pthread_atfork runs around a fork
+    mavalloc_fork_prepare( );
+    pid_t pid = fork();
+    if( pid == 0 )
+    {
+      mavalloc_fork_child( );
+      void * ptr = mavalloc_alloc ( 32 );
+      _exit( ptr == NULL );
+    }
+    mavalloc_fork_parent( );
+    TINYTEST_ASSERT( pid > 0 );
+
+    // If you failed here the child found the arena locked or broken
+    int status;
+    TINYTEST_EQUAL( waitpid( pid, &status, 0 ), pid );
+    TINYTEST_ASSERT( WIFEXITED( status ) );
+    TINYTEST_EQUAL( WEXITSTATUS( status ), 0 );
+  }
+  fork_worker_done = 1;
+  pthread_join( worker, NULL );
+  mavalloc_destroy( );
+  return 1;
+}
+
+int test_case_44()
+{
+  const char * path = "/tmp/mavalloc_test_case_44.trace";
+  mavalloc_init( 4096, FIRST_FIT );
+  TINYTEST_EQUAL( mavalloc_trace_start( path ), 0 );
+
+  int h1 = mavalloc_halloc( 100 );
+  int h2 = mavalloc_halloc( 16 );
+  mavalloc_hfree( h1 );
+
+  // If you failed here compaction did not slide the block down
+  TINYTEST_EQUAL( mavalloc_compact( 0 ), 16 );
+  mavalloc_hfree( h2 );
+
+  mavalloc_trace_stop( );
+  mavalloc_destroy( );
+
+  FILE * f = fopen( path, "rb" );
+  TINYTEST_ASSERT( f );
+  struct mavalloc_trace_header header;
+  TINYTEST_EQUAL( fread( &header, sizeof( header ), 1, f ), 1 );
+  struct mavalloc_trace_record records[16];
+  size_t count = fread( records, sizeof( records[0] ), 16, f );
+  fclose( f );
+  unlink( path );
+
+  // If you failed here handle allocations and frees were not traced
+  TINYTEST_EQUAL( count, 6 );
+  TINYTEST_EQUAL( records[0].op, MAVALLOC_TRACE_ALLOC );
+  TINYTEST_EQUAL( records[0].size, 100 );
+  TINYTEST_EQUAL( records[0].offset, 0 );
+  TINYTEST_EQUAL( records[1].op, MAVALLOC_TRACE_ALLOC );
+  TINYTEST_EQUAL( records[1].offset, 100 );
+  TINYTEST_EQUAL( records[2].op, MAVALLOC_TRACE_FREE );
+  TINYTEST_EQUAL( records[2].offset, 0 );
+
+  // If you failed here the move was not traced as a free and an allocation
+  TINYTEST_EQUAL( records[3].op, MAVALLOC_TRACE_FREE );
+  TINYTEST_EQUAL( records[3].offset, 100 );
+  TINYTEST_EQUAL( records[4].op, MAVALLOC_TRACE_ALLOC );
+  TINYTEST_EQUAL( records[4].size, 16 );
+  TINYTEST_EQUAL( records[4].offset, 0 );
+  TINYTEST_EQUAL( records[5].op, MAVALLOC_TRACE_FREE );
+  TINYTEST_EQUAL( records[5].offset, 0 );
+  return 1;
+}
+
 int tinytest_setup(const char *pName)
 {
     fprintf( stderr, "tinytest_setup(%s)\n", pName);
@@ -672,6 +1978,30 @@ TINYTEST_START_SUITE(MavAllocTestSuite);
   TINYTEST_ADD_TEST(test_case_18,tinytest_setup,tinytest_teardown);
   TINYTEST_ADD_TEST(test_case_19,tinytest_setup,tinytest_teardown);
   TINYTEST_ADD_TEST(test_case_20,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_21,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_22,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_23,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_24,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_25,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_26,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_27,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_28,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_29,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_30,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_31,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_32,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_33,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_34,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_35,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_36,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_37,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_38,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_39,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_40,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_41,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_42,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_43,tinytest_setup,tinytest_teardown);
+  TINYTEST_ADD_TEST(test_case_44,tinytest_setup,tinytest_teardown);
 TINYTEST_END_SUITE();
 
 TINYTEST_MAIN_SINGLE_SUITE(MavAllocTestSuite);
@@ -20,11 +20,49 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
 // THE SOFTWARE.
 
+#define _GNU_SOURCE
 #include "mavalloc.h"
+#include "mavalloc_trace.h"
+#include <errno.h>
 #include <limits.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
 
 #define MAX_ALLOCS 10000
+// number of hash buckets indexing live allocations by address
+#define LIVE_BUCKETS 4096
+// most memory regions an arena can span, the pool plus grown chunks
+#define MAX_CHUNKS 64
+// size of a huge page, used to align the pool and large allocations
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+// default size from which MAVALLOC_LARGE maps allocations on their own
+#define LARGE_THRESHOLD (256 * 1024)
+// most large objects mapped at once, further ones go to the ledger
+#define MAX_LARGE 128
+// largest size served by the MAVALLOC_QUICKFIT bins, one bin per ALIGN4 step
+#define QUICK_MAX 256
+#define QUICK_BINS (QUICK_MAX / 4)
+// searches between two ADAPTIVE decisions
+#define ADAPT_EPOCH 1024
+// fragmentation above which ADAPTIVE moves to best fit, and below which
+// it leaves best fit again
+#define ADAPT_FRAG_HIGH 0.5
+#define ADAPT_FRAG_LOW 0.25
+// nodes visited per search above which first fit gives way to next fit
+#define ADAPT_LONG_SEARCH 32
+// most NUMA nodes a policy can name, the width of the mbind node mask
+#define MAX_NUMA_NODES (sizeof(unsigned long) * CHAR_BIT)
 
 // pool stores the address of the large memory pool we allocate
 // inside of mavalloc_init()
@@ -35,248 +73,2265 @@ static size_t pool_size;
 // stores the allocation algorithm
 enum ALGORITHM alloc_algorithm;
 
-int ledger_top = -1; // stores index of the last ledger item
+// with ADAPTIVE, the algorithm the searches currently use
+static enum ALGORITHM adaptive_algorithm = NEXT_FIT;
+// what the current ADAPTIVE epoch has seen so far
+static long adapt_searches;
+static long adapt_failures;
+static long adapt_steps;
+// ledger nodes visited by the fit functions, never reset while the arena
+// lives so callers can take the difference around a search
+static long search_steps;
+
+// the statement only goes into builds with MAVALLOC_INSTRUMENT defined,
+// everywhere else it compiles to nothing
+#ifdef MAVALLOC_INSTRUMENT
+#define INSTRUMENT(statement) statement
+static struct mavalloc_counters counters;
+#else
+#define INSTRUMENT(statement)
+#endif
+
+// stores the MAVALLOC_FLAG bits passed to mavalloc_init_flags()
+static int arena_flags;
+
+// where the memory of a chunk comes from
+enum BACKING
+{
+	MALLOCED, // malloc, released with free
+	MAPPED, // private anonymous mmap, released with munmap
+	SHARED // shared file mapping, released with the whole file
+};
+
+// a contiguous region of memory backing part of the arena. Chunk 0 is
+// the pool, the rest are mapped by grow_arena()
+typedef struct Chunk
+{
+	void *base; // NULL once a grown chunk has been unmapped again
+	size_t size;
+	enum BACKING backing;
+	int node; // NUMA node a NUMA_PER_NODE chunk serves, otherwise -1
+} Chunk;
+
+static Chunk chunks[MAX_CHUNKS];
+static int num_chunks = 0;
+// size of the most recently mapped chunk, the next one is twice as big
+static size_t last_chunk_size;
+
+// an allocation mapped on its own by MAVALLOC_LARGE
+typedef struct Large
+{
+	void *base;
+	size_t size;
+} Large;
+
+// the large objects in use, packed at the front of the table
+static Large large[MAX_LARGE];
+static int num_large = 0;
+// with MAVALLOC_LARGE, allocations of at least this many bytes are large
+static size_t large_threshold = LARGE_THRESHOLD;
+
+// with MAVALLOC_QUICKFIT, the heads of the LIFO lists of freed blocks of
+// each small size, see bin_push()
+static int quick_bins[QUICK_BINS];
+// number of blocks in all quick bins
+static int quick_count = 0;
+
+// NUMA placement of the pool and chunks, see numa_bind()
+static enum NUMA_POLICY numa_policy = NUMA_DEFAULT;
+// node named by NUMA_BIND, or the caller's node for NUMA_LOCAL
+static int numa_node;
+// online NUMA nodes of the system, node 0 alone without NUMA. Node ids
+// may have gaps, so the number of nodes and the highest id differ
+static unsigned long numa_online = 1;
+static int numa_nodes = 1;
+// with NUMA_PER_NODE, the node the running search is restricted to or -1
+static int search_node = -1;
+
+// how long a hole has to stay free before purging returns its pages to
+// the OS, in milliseconds. -1 disables purging
+static long decay_ms = -1;
+// earliest time the free path runs the next purge pass
+static long long next_purge_ns;
 
 enum TYPE
 {
 	P, // Process Allocation
-	H // Hole
+	H, // Hole
+	Q // freed into a quick bin, neither allocated nor coalesced
 };
 
 typedef struct Node
 {
 	size_t size;
 	enum TYPE type;
-	void *arena;
+	size_t offset; // where the entry starts, from the base of its chunk
+	int chunk; // index of the chunk the entry lies in
+	long long freed_at; // when the entry last became a hole
+	size_t clean_start; // [clean_start, clean_end) from offset is known to
+	size_t clean_end;   // be zero because its pages were purged
 	int next;
 	int previous;
+	int bucket_next; // chain of allocations sharing a live bucket, or of
+	int bucket_previous; // the blocks in a quick bin
+	int handle; // handle the block was allocated through or -1
+	int heap_pos; // where a hole sits in the hole heap
 } Node;
 
-// Keeps track of space - holes and process allocations
-Node ledger[MAX_ALLOCS];
+// marks a file that holds a mavalloc heap, "mavalloc" in ASCII
+#define HEADER_MAGIC 0x636f6c6c6176616dULL
 
-// traverses to the back of the ledger to find the index of the first entry
-int traverse_back()
+// the ledger and everything else needed to find our way around the pool.
+// Entries only hold offsets, so a file backed arena keeps its header at
+// the start of the file and reopening the file restores the whole heap
+typedef struct Header
 {
-	static int ptr = 0; // static so we save the last return value
-	if(ledger[ptr].next == -1) // if the saved value was freed or destroy was called
-		ptr = 0; // start search from index 0
-	while(ledger[ptr].previous != -1)
-	{
-		ptr = ledger[ptr].previous;
-	}
-	return ptr;
+	uint64_t magic;
+	size_t header_size; // sizeof(Header), catches layout changes
+	size_t pool_size;
+	int ledger_top; // stores index of the last ledger item
+	int ledger_head; // stores index of the first entry (lowest address)
+	int free_slot_top;
+	int root; // ledger index of the block set by mavalloc_set_root or -1
+	// serializes the public API. Process shared and robust in mapped heaps
+	// so every process attached to a shared heap takes the same lock
+	pthread_mutex_t lock;
+	// heads of the live bucket chains, see live_bucket()
+	int live_buckets[LIVE_BUCKETS];
+	// kept up to date by every operation, see mavalloc_stats()
+	size_t live_bytes;
+	size_t live_count;
+	size_t high_water; // most live_bytes ever reached
+	size_t hole_bytes;
+	// max-heap of the holes ordered by hole_before(), hole_count long
+	int hole_count;
+	int hole_heap[MAX_ALLOCS];
+	// ledger slots that were unlinked by coalescing, reused before ledger_top grows
+	int free_slots[MAX_ALLOCS];
+	int handle_top; // highest handle handed out so far
+	int free_handle_top;
+	// ledger index of the block behind each handle, -1 once it is freed
+	int handles[MAX_ALLOCS];
+	// how often each handle is pinned, compaction never moves pinned blocks
+	int pins[MAX_ALLOCS];
+	// handles freed by mavalloc_hfree, reused before handle_top grows
+	int free_handles[MAX_ALLOCS];
+	// Keeps track of space - holes and process allocations
+	Node ledger[MAX_ALLOCS];
+} Header;
+
+// header of arenas that live in memory only
+static Header static_header = { .ledger_top = -1, .ledger_head = -1, .free_slot_top = -1, .root = -1,
+                                 .handle_top = -1, .free_handle_top = -1,
+                                 .lock = PTHREAD_MUTEX_INITIALIZER };
+// header of the current arena and its ledger
+static Header *header = &static_header;
+static Node *ledger = static_header.ledger;
+
+// the mapping and descriptor of a file or shared memory backed arena
+static void *file_map = NULL;
+static size_t file_map_size;
+static int file_fd = -1;
+
+// how a mapped heap is opened, see map_heap()
+enum HEAP_OPEN
+{
+	HEAP_CREATE, // size the file and write a fresh heap
+	HEAP_REOPEN, // map an existing heap nobody else has open
+	HEAP_ATTACH // map a heap other processes may be using or still creating
+};
+
+// how long HEAP_ATTACH waits for the creator to finish, in milliseconds
+#define ATTACH_WAIT_MS 5000
+
+// monotonic clock in nanoseconds
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-int mavalloc_init( size_t size, enum ALGORITHM algorithm )
+// takes the lock of the current arena. If the process holding a shared
+// arena's lock died, the lock is taken over and the heap used as it is
+static void arena_lock()
 {
-	// Set the algorithm global
-	alloc_algorithm = algorithm;
-	// negative sizes make no sense, so we don't process that case
-	if(size < 0)
-		return -1;
-	
-	// allocate the pool of memory and store its size aligned
-	pool_size = ALIGN4(size);
-	pool = malloc(pool_size);
+	if(pthread_mutex_lock(&header->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&header->lock);
+}
 
-	// if the allocation failed, return -1 to indicate failure
-	if (pool == NULL)
-		return -1;
-	
-	// initializing the first entry in the ledger
-	// to start, we have just one hole being the pool we malloc'd
-	ledger_top = 0;
-	ledger[0].arena = pool;
-	ledger[0].size = pool_size;
-	ledger[0].previous = -1; // no next element
-	ledger[0].next = -1; // no previous element
-	ledger[0].type = H;
+static void arena_unlock()
+{
+	pthread_mutex_unlock(&header->lock);
+}
 
-	// initialize the rest of the ledger with starting values
-	for(int i = 1; i < MAX_ALLOCS; i++)
+// initializes the lock of a mapped heap so it works across processes
+static void init_lock(Header *h)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&h->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+// records buffered per thread before they are appended to the trace file
+#define TRACE_RING 4096
+
+// a thread's buffer of trace records. Only its thread writes to it, so
+// recording an event takes no lock
+typedef struct TraceRing
+{
+	struct mavalloc_trace_record records[TRACE_RING];
+	int count;
+	uint32_t thread;
+	struct TraceRing *next; // in the list of every thread's ring
+} TraceRing;
+
+// descriptor of the trace file, -1 while not tracing
+static int trace_fd = -1;
+// every thread's ring, the list is guarded by trace_lock
+static TraceRing *trace_rings = NULL;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+// flushes a thread's ring when it exits
+static pthread_key_t trace_key;
+static pthread_once_t trace_key_once = PTHREAD_ONCE_INIT;
+static __thread TraceRing *trace_ring = NULL;
+
+// appends the records buffered in ring to the trace file
+static void trace_flush(TraceRing *ring)
+{
+	char *data = (char *) ring->records;
+	size_t left = ring->count * sizeof(struct mavalloc_trace_record);
+	while(trace_fd != -1 && left > 0)
 	{
-		ledger[i].arena = NULL;
-		ledger[i].size = 0;
-		ledger[i].previous = -1;
-		ledger[i].next = -1;
+		ssize_t written = write(trace_fd, data, left);
+		if(written <= 0)
+			break;
+		data += written;
+		left -= written;
 	}
-
-	// returns 0 on success
-	return 0;
+	ring->count = 0;
 }
 
-void mavalloc_destroy( )
+// flushes and frees the ring of an exiting thread
+static void trace_ring_exit(void *arg)
 {
-	free(pool); // free the pool allocated
-	// reset ledger to initial state
-	for(int i = 0; i < MAX_ALLOCS; i++)
+	TraceRing *ring = arg;
+	pthread_mutex_lock(&trace_lock);
+	trace_flush(ring);
+	TraceRing **link = &trace_rings;
+	while(*link != ring)
 	{
-		ledger[i].arena = NULL;
-		ledger[i].size = 0;
-		ledger[i].previous = -1;
-		ledger[i].next = -1;
+		link = &(*link)->next;
 	}
-	pool_size = 0;
-	ledger_top = -1;
-	return;
+	*link = ring->next;
+	pthread_mutex_unlock(&trace_lock);
+	munmap(ring, sizeof(TraceRing));
 }
 
-int first_fit(size_t size)
+static void trace_key_create()
 {
-	int ptr = traverse_back();
-	while(ptr != -1 && (ledger[ptr].size < size || ledger[ptr].type == P))
+	pthread_key_create(&trace_key, trace_ring_exit);
+}
+
+// returns the calling thread's ring, creating it on first use
+static TraceRing *trace_ring_get()
+{
+	if(trace_ring != NULL)
+		return trace_ring;
+	pthread_once(&trace_key_once, trace_key_create);
+	// mapped rather than malloc'd, the trace may be recording malloc itself
+	TraceRing *ring = mmap(NULL, sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(ring == MAP_FAILED)
+		return NULL;
+	ring->thread = (uint32_t) syscall(SYS_gettid);
+	pthread_mutex_lock(&trace_lock);
+	ring->next = trace_rings;
+	trace_rings = ring;
+	pthread_mutex_unlock(&trace_lock);
+	pthread_setspecific(trace_key, ring);
+	trace_ring = ring;
+	return ring;
+}
+
+// records an allocation or free of block in the calling thread's ring,
+// flushing it to the trace file when it is full
+static void trace_event(enum MAVALLOC_TRACE_OP op, size_t size, void *block, int index, long steps)
+{
+	TraceRing *ring = trace_ring_get();
+	if(ring == NULL)
+		return;
+	struct mavalloc_trace_record *r = &ring->records[ring->count++];
+	r->timestamp_ns = now_ns();
+	r->size = size;
+	r->offset = block ? (int64_t) ((intptr_t) block - (intptr_t) pool) : 0;
+	r->index = index;
+	r->nodes_visited = (uint32_t) steps;
+	r->thread = ring->thread;
+	r->op = op;
+	r->flags = op == MAVALLOC_TRACE_ALLOC && block == NULL ? MAVALLOC_TRACE_FAILED : 0;
+	if(ring->count == TRACE_RING)
+		trace_flush(ring);
+}
+
+// returns the index of the first entry in the ledger
+int traverse_back()
+{
+	return header->ledger_head;
+}
+
+// address of the memory the entry at i describes
+static char *block_addr(int i)
+{
+	return (char *) chunks[ledger[i].chunk].base + ledger[i].offset;
+}
+
+// finds the chunk ptr lies in and stores its offset in that chunk.
+// returns the chunk index, or -1 if ptr is not in the arena
+static int locate(void *ptr, size_t *offset)
+{
+	for(int c = 0; c < num_chunks; c++)
 	{
-		ptr = ledger[ptr].next;
+		uintptr_t base = (uintptr_t) chunks[c].base;
+		if(base != 0 && (uintptr_t) ptr >= base && (uintptr_t) ptr < base + chunks[c].size)
+		{
+			*offset = (uintptr_t) ptr - base;
+			return c;
+		}
 	}
-	return ptr;
+	return -1;
 }
 
-int next_fit(size_t size)
+// returns an unused ledger slot, or -1 if the ledger is full
+static int ledger_node_new()
 {
-	static int last_ptr = 0;
-	int ptr = last_ptr;
-	while (ptr != -1 && (ledger[ptr].size < size || ledger[ptr].type == P))
+	if(header->free_slot_top >= 0)
+		return header->free_slots[header->free_slot_top--];
+	if(header->ledger_top + 1 >= MAX_ALLOCS)
+		return -1;
+	return ++header->ledger_top;
+}
+
+// hands a slot that is no longer linked into the list back for reuse
+static void ledger_node_release(int idx)
+{
+	ledger[idx].offset = 0;
+	ledger[idx].size = 0;
+	ledger[idx].previous = -1;
+	ledger[idx].next = -1;
+	header->free_slots[++header->free_slot_top] = idx;
+}
+
+// hashes the position of a block to the bucket that indexes it
+static unsigned live_bucket(int chunk, size_t offset)
+{
+	uint64_t key = ((uint64_t) offset >> 2) ^ ((uint64_t) chunk << 48);
+	return (unsigned) ((key * 0x9E3779B97F4A7C15ull) >> 52) & (LIVE_BUCKETS - 1);
+}
+
+// links the allocation at idx into its live bucket
+static void live_insert(int idx)
+{
+	unsigned b = live_bucket(ledger[idx].chunk, ledger[idx].offset);
+	ledger[idx].bucket_previous = -1;
+	ledger[idx].bucket_next = header->live_buckets[b];
+	if(header->live_buckets[b] != -1)
+		ledger[header->live_buckets[b]].bucket_previous = idx;
+	header->live_buckets[b] = idx;
+	header->live_count++;
+	header->live_bytes += ledger[idx].size;
+	if(header->live_bytes > header->high_water)
+		header->high_water = header->live_bytes;
+}
+
+// unlinks the allocation at idx from its live bucket
+static void live_remove(int idx)
+{
+	if(ledger[idx].bucket_previous != -1)
+		ledger[ledger[idx].bucket_previous].bucket_next = ledger[idx].bucket_next;
+	else
+		header->live_buckets[live_bucket(ledger[idx].chunk, ledger[idx].offset)] = ledger[idx].bucket_next;
+	if(ledger[idx].bucket_next != -1)
+		ledger[ledger[idx].bucket_next].bucket_previous = ledger[idx].bucket_previous;
+	header->live_count--;
+	header->live_bytes -= ledger[idx].size;
+}
+
+// true if hole a belongs above hole b in the hole heap: the larger one,
+// or the lower one if they are the same size. The top is then the hole
+// a worst fit scan of the list would pick
+static int hole_before(int a, int b)
+{
+	if(ledger[a].size != ledger[b].size)
+		return ledger[a].size > ledger[b].size;
+	return (uintptr_t) block_addr(a) < (uintptr_t) block_addr(b);
+}
+
+// puts hole i at position pos of the heap
+static void heap_place(int pos, int i)
+{
+	header->hole_heap[pos] = i;
+	ledger[i].heap_pos = pos;
+}
+
+static void heap_up(int i)
+{
+	int pos = ledger[i].heap_pos;
+	while(pos > 0 && hole_before(i, header->hole_heap[(pos - 1) / 2]))
 	{
-		ptr = ledger[ptr].next;
+		heap_place(pos, header->hole_heap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
 	}
-	if(ptr == -1)
+	heap_place(pos, i);
+}
+
+static void heap_down(int i)
+{
+	int pos = ledger[i].heap_pos;
+	for(;;)
 	{
-		ptr = first_fit(size);
+		int child = 2 * pos + 1;
+		if(child >= header->hole_count)
+			break;
+		if(child + 1 < header->hole_count && hole_before(header->hole_heap[child + 1], header->hole_heap[child]))
+			child++;
+		if(!hole_before(header->hole_heap[child], i))
+			break;
+		heap_place(pos, header->hole_heap[child]);
+		pos = child;
 	}
-	last_ptr = ptr;
-	return ptr;
+	heap_place(pos, i);
 }
 
-int worst_fit(size_t size) // take the largest available hole
+// adds the entry at i, which just became a hole, to the hole heap
+static void hole_insert(int i)
 {
-	int max_hole_idx = -1;
-	int max_hole_size = -1;
-	for(int ptr = traverse_back(); ptr != -1; ptr = ledger[ptr].next)
+	heap_place(header->hole_count++, i);
+	header->hole_bytes += ledger[i].size;
+	heap_up(i);
+}
+
+// takes the hole at i out of the hole heap
+static void hole_remove(int i)
+{
+	int last = header->hole_heap[--header->hole_count];
+	header->hole_bytes -= ledger[i].size;
+	if(last == i)
+		return;
+	heap_place(ledger[i].heap_pos, last);
+	heap_up(last);
+	heap_down(last);
+}
+
+// moves the hole at i to its place after its size or address changed.
+// old_size is what the heap accounted for it so far
+static void hole_resized(int i, size_t old_size)
+{
+	header->hole_bytes += ledger[i].size - old_size;
+	heap_up(i);
+	heap_down(i);
+}
+
+// number of slots ledger_node_new() can still hand out
+static size_t ledger_nodes_available()
+{
+	return (size_t) (header->free_slot_top + 1) + (size_t) (MAX_ALLOCS - 1 - header->ledger_top);
+}
+
+// returns the mask of the online NUMA nodes, node 0 alone without NUMA.
+// The kernel lists them as ranges like 0,2-3
+static unsigned long online_numa_nodes()
+{
+	char list[256];
+	unsigned long mask = 0;
+	FILE *f = fopen("/sys/devices/system/node/online", "r");
+	if(f == NULL)
+		return 1;
+	if(fgets(list, sizeof(list), f) == NULL)
+		list[0] = '\0';
+	fclose(f);
+	char *p = list;
+	while(*p >= '0' && *p <= '9')
 	{
-		if(ledger[ptr].type == H && ledger[ptr].size >= size && (long) ledger[ptr].size > max_hole_size)
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if(*end == '-')
+			last = strtol(end + 1, &end, 10);
+		for(long n = first; n <= last && n < (long) MAX_NUMA_NODES; n++)
 		{
-			max_hole_size = ledger[ptr].size;
-			max_hole_idx = ptr;
+			mask |= 1UL << n;
 		}
+		p = *end == ',' ? end + 1 : end;
 	}
-	return max_hole_idx;
+	return mask != 0 ? mask : 1;
 }
 
-int best_fit(size_t size) // take the smallest available hole
+// returns the id of the nth online NUMA node, counting from 0
+static int nth_numa_node(int n)
 {
-	int min_hole_idx = -1;
-	int min_hole_size = INT_MAX;
-	for (int ptr = traverse_back(); ptr != -1; ptr = ledger[ptr].next)
+	unsigned long mask = numa_online;
+	while(n-- > 0)
 	{
-		if (ledger[ptr].type == H && ledger[ptr].size >= size && (long) ledger[ptr].size < min_hole_size)
-		{
-			min_hole_size = ledger[ptr].size;
-			min_hole_idx = ptr;
-		}
+		mask &= mask - 1;
 	}
-	return min_hole_idx;
+	return __builtin_ctzl(mask);
 }
 
-void * mavalloc_alloc( size_t size )
+// returns the NUMA node of the CPU the caller is running on
+static int current_numa_node()
 {
-	int idx = -1;
-	size = ALIGN4(size);
-	// get the index of the hole in which memory will be allocated
-	// based on the algorithm global set
-	switch(alloc_algorithm)
+	unsigned cpu, node;
+	if(getcpu(&cpu, &node) != 0 || node >= MAX_NUMA_NODES || !(numa_online >> node & 1))
+		return nth_numa_node(0);
+	return (int) node;
+}
+
+// applies the NUMA policy to a fresh mapping before its pages are
+// touched. node is the node a NUMA_PER_NODE chunk serves. On kernels
+// without NUMA support mbind fails and the mapping keeps the default
+// policy, which is what a single node machine does anyway
+static void numa_bind(void *base, size_t len, int node)
+{
+	unsigned long mask;
+	int mode;
+	switch(numa_policy)
 	{
-		case FIRST_FIT:
-			idx = first_fit(size);
+		case NUMA_BIND:
+			mode = MPOL_BIND;
+			mask = 1UL << numa_node;
 			break;
-		case NEXT_FIT:
-			idx = next_fit(size);
+		case NUMA_INTERLEAVE:
+			mode = MPOL_INTERLEAVE;
+			mask = numa_online;
 			break;
-		case WORST_FIT:
-			idx = worst_fit(size);
+		case NUMA_LOCAL:
+			mode = MPOL_PREFERRED;
+			mask = 1UL << numa_node;
 			break;
-		case BEST_FIT:
-			idx = best_fit(size);
+		case NUMA_PER_NODE:
+			mode = MPOL_BIND;
+			mask = 1UL << node;
 			break;
+		default:
+			return;
 	}
-	// only return NULL on failure
-	if (idx == -1)
-		return NULL;
+	// the mask is as wide as the highest online node id, plus the one
+	// the kernel drops from maxnode
+	int width = (int) (sizeof(unsigned long) * CHAR_BIT) - __builtin_clzl(numa_online);
+	syscall(SYS_mbind, base, len, mode, &mask, (unsigned long) width + 1, 0);
+}
 
+// rounds x up to a multiple of align
+static size_t round_up(size_t x, size_t align)
+{
+	return (x + align - 1) / align * align;
+}
 
-	if(ledger[idx].size == size)
+// faults in every page of a region by writing to it. Writing zeros keeps
+// fresh anonymous memory reading as zero
+static void prefault(char *base, size_t len)
+{
+#ifdef MADV_POPULATE_WRITE
+	if(madvise(base, len, MADV_POPULATE_WRITE) == 0)
+		return;
+#endif
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	for(size_t off = 0; off < len; off += page)
 	{
-		ledger[idx].type = P;
-		return ledger[idx].arena;
+		((volatile char *) base)[off] = 0;
 	}
-	ledger_top++;
-
-	// allocate memory at the hole in ledger[idx]
-	ledger[ledger_top].size = size;
-	ledger[ledger_top].type = P;
-	ledger[ledger_top].previous = ledger[idx].previous;
-	if(ledger[idx].previous != -1)
-		ledger[ledger[idx].previous].next = ledger_top;
-	ledger[ledger_top].next = idx;
-	ledger[idx].previous = ledger_top;
-	
-	ledger[idx].size -= size;
-
-	ledger[ledger_top].arena = ledger[idx].arena;
-
-	ledger[idx].arena = (void*) ((long long)ledger[idx].arena + size);
-	
-	return ledger[ledger_top].arena;
-	
 }
 
-void mavalloc_free( void * ptr )
+// maps anonymous memory for a chunk of at least *size bytes and stores
+// the mapped size in *size. With MAVALLOC_HUGEPAGES the chunk is huge
+// page aligned, backed by reserved huge pages if there are any and by
+// transparent huge pages otherwise. The chunk is placed by the NUMA
+// policy, on node for NUMA_PER_NODE. MAVALLOC_PREFAULT faults every page
+// in up front and MAVALLOC_MLOCK locks them. returns NULL on failure
+static void *map_chunk(size_t *size, int node)
 {
-	if(!ptr)
-		return;
-	int i = traverse_back();
-	while(i != -1 && ledger[i].arena != ptr)
+	int prot = PROT_READ | PROT_WRITE;
+	int map = MAP_PRIVATE | MAP_ANONYMOUS;
+	// pages have to be placed by the NUMA policy before they are touched,
+	// so populate by hand after binding when there is a policy
+	int prefault_later = (arena_flags & MAVALLOC_PREFAULT) && numa_policy != NUMA_DEFAULT;
+	int populate = (arena_flags & MAVALLOC_PREFAULT) && !prefault_later ? MAP_POPULATE : 0;
+	size_t len;
+	void *base;
+
+	if(!(arena_flags & MAVALLOC_HUGEPAGES))
 	{
-		i = ledger[i].next;
+		len = round_up(*size, (size_t) sysconf(_SC_PAGESIZE));
+		base = mmap(NULL, len, prot, map | populate, -1, 0);
+		if(base == MAP_FAILED)
+			return NULL;
 	}
-	if(i != -1)
+	else
 	{
-		ledger[i].type = H;
-		// coalesce backwards
-		if(ledger[i].previous != -1 && ledger[ledger[i].previous].type == H)
-		{
-			ledger[ledger[i].previous].size += ledger[i].size;
-			if(i == ledger_top)
-			{
-				ledger_top--;
-			}
-			i = ledger[i].previous;
-			ledger[i].next = ledger[ledger[i].next].next;
-			ledger[ledger[i].next].previous = i;
-		}
-		// coalesce forward
-		if(ledger[i].next != -1 && ledger[ledger[i].next].type == H)
+		len = round_up(*size, HUGE_PAGE_SIZE);
+		base = mmap(NULL, len, prot, map | populate | MAP_HUGETLB, -1, 0);
+		if(base == MAP_FAILED)
 		{
-			ledger[i].size += ledger[ledger[i].next].size;
-			ledger[i].next = ledger[ledger[i].next].next;
-			ledger[ledger[i].next].previous = i;
+			// over-map by a huge page so an aligned region fits, then trim
+			char *raw = mmap(NULL, len + HUGE_PAGE_SIZE, prot, map, -1, 0);
+			if(raw == MAP_FAILED)
+				return NULL;
+			char *aligned = (char *) round_up((uintptr_t) raw, HUGE_PAGE_SIZE);
+			if(aligned != raw)
+				munmap(raw, aligned - raw);
+			if(aligned - raw != HUGE_PAGE_SIZE)
+				munmap(aligned + len, HUGE_PAGE_SIZE - (aligned - raw));
+			base = aligned;
+			madvise(base, len, MADV_HUGEPAGE);
+			// populate only after the advice so the faults take huge pages
+			prefault_later = (arena_flags & MAVALLOC_PREFAULT) != 0;
 		}
 	}
+
+	numa_bind(base, len, node);
+	if(prefault_later)
+		prefault(base, len);
+
+	if((arena_flags & MAVALLOC_MLOCK) && mlock(base, len) != 0)
+	{
+		munmap(base, len);
+		return NULL;
+	}
+	*size = len;
+	return base;
 }
 
-int mavalloc_size( )
+// creates a hole spanning the fresh chunk c and links it into the
+// ledger, keeping the ledger in address order. returns its index
+static int link_chunk(int c)
 {
-	int number_of_nodes = 0;
-	
-	if(ledger[traverse_back()].arena == NULL)
+	// fresh anonymous pages read as zero
+	int node = ledger_node_new();
+	ledger[node].offset = 0;
+	ledger[node].chunk = c;
+	ledger[node].freed_at = now_ns();
+	ledger[node].clean_start = 0;
+	ledger[node].clean_end = chunks[c].size;
+	ledger[node].size = chunks[c].size;
+	ledger[node].type = H;
+	hole_insert(node);
+
+	// find the first entry above the new chunk and link in front of it
+	int prev = -1;
+	int next = traverse_back();
+	while(next != -1 && (uintptr_t) block_addr(next) < (uintptr_t) chunks[c].base)
 	{
-		return 0;
+		prev = next;
+		next = ledger[next].next;
+	}
+	ledger[node].previous = prev;
+	ledger[node].next = next;
+	if(prev != -1)
+		ledger[prev].next = node;
+	else
+		header->ledger_head = node;
+	if(next != -1)
+		ledger[next].previous = node;
+
+	return node;
+}
+
+// resets the ledger in the current header to a single hole spanning
+// chunk 0, which is known to be zero if clean is set
+static void ledger_init(int clean)
+{
+	// initializing the first entry in the ledger
+	// to start, we have just one hole being the pool we malloc'd
+	header->pool_size = pool_size;
+	header->ledger_top = 0;
+	header->ledger_head = 0;
+	header->free_slot_top = -1;
+	header->root = -1;
+	header->handle_top = -1;
+	header->free_handle_top = -1;
+	ledger[0].offset = 0;
+	ledger[0].chunk = 0;
+	ledger[0].freed_at = now_ns();
+	ledger[0].clean_start = 0;
+	ledger[0].clean_end = clean ? pool_size : 0;
+	ledger[0].size = pool_size;
+	ledger[0].previous = -1; // no next element
+	ledger[0].next = -1; // no previous element
+	ledger[0].type = H;
+
+	header->live_bytes = 0;
+	header->live_count = 0;
+	header->high_water = 0;
+	header->hole_bytes = 0;
+	header->hole_count = 0;
+	hole_insert(0);
+
+	for(int i = 0; i < LIVE_BUCKETS; i++)
+	{
+		header->live_buckets[i] = -1;
+	}
+	for(int i = 0; i < QUICK_BINS; i++)
+	{
+		quick_bins[i] = -1;
+	}
+	quick_count = 0;
+
+	// initialize the rest of the ledger with starting values
+	for(int i = 1; i < MAX_ALLOCS; i++)
+	{
+		ledger[i].offset = 0;
+		ledger[i].size = 0;
+		ledger[i].previous = -1;
+		ledger[i].next = -1;
 	}
+}
+
+int mavalloc_init( size_t size, enum ALGORITHM algorithm )
+{
+	return mavalloc_init_flags(size, algorithm, 0);
+}
 
+int mavalloc_init_flags( size_t size, enum ALGORITHM algorithm, int flags )
+{
+	return mavalloc_init_numa(size, algorithm, flags, NUMA_DEFAULT, 0);
+}
+
+int mavalloc_init_numa( size_t size, enum ALGORITHM algorithm, int flags,
+                        enum NUMA_POLICY policy, int node )
+{
+	// Set the algorithm, flag and NUMA globals
+	alloc_algorithm = algorithm;
+	arena_flags = flags;
+	numa_policy = policy;
+	numa_online = policy == NUMA_DEFAULT ? 1 : online_numa_nodes();
+	numa_nodes = __builtin_popcountl(numa_online);
+	numa_node = policy == NUMA_LOCAL ? current_numa_node() : node;
+	// negative sizes make no sense, so we don't process that case
+	if(size < 0)
+		return -1;
+	if(policy == NUMA_BIND && (node < 0 || node >= (int) MAX_NUMA_NODES || !(numa_online >> node & 1)))
+		return -1;
+
+	// with a pool per online node each node gets an equal share of the size
+	int pools = policy == NUMA_PER_NODE ? numa_nodes : 1;
+
+	// allocate the pool of memory and store its size aligned
+	pool_size = ALIGN4(size / pools);
+	int mapped = policy != NUMA_DEFAULT ||
+		(flags & (MAVALLOC_MMAP | MAVALLOC_HUGEPAGES | MAVALLOC_PREFAULT | MAVALLOC_MLOCK)) != 0;
+	if(mapped)
+		pool = map_chunk(&pool_size, nth_numa_node(0));
+	else
+		pool = malloc(pool_size);
+
+	// if the allocation failed, return -1 to indicate failure
+	if (pool == NULL)
+		return -1;
+
+	chunks[0].base = pool;
+	chunks[0].size = pool_size;
+	chunks[0].backing = mapped ? MAPPED : MALLOCED;
+	chunks[0].node = policy == NUMA_PER_NODE ? nth_numa_node(0) : -1;
+	num_chunks = 1;
+	last_chunk_size = pool_size;
+	
+	ledger_init(mapped);
+
+	// map the pools of the remaining nodes. They are chunks like the ones
+	// a growing arena adds, pool and pool_size stay chunk 0 so offsets
+	// never reach past it
+	for(int n = 1; n < pools; n++)
+	{
+		size_t node_size = ALIGN4(size / pools);
+		void *base = map_chunk(&node_size, nth_numa_node(n));
+		if(base == NULL)
+		{
+			mavalloc_destroy();
+			return -1;
+		}
+		chunks[n].base = base;
+		chunks[n].size = node_size;
+		chunks[n].backing = MAPPED;
+		chunks[n].node = nth_numa_node(n);
+		num_chunks++;
+		link_chunk(n);
+	}
+
+	// returns 0 on success
+	return 0;
+}
+
+// maps the heap held by fd and makes it the current arena, see HEAP_OPEN.
+// A created heap is size bytes. The caller closes fd on failure
+static int map_heap(int fd, size_t size, enum ALGORITHM algorithm, enum HEAP_OPEN how)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	size_t header_bytes = round_up(sizeof(Header), page);
+	struct stat st;
+	size_t map_size = header_bytes + round_up(ALIGN4(size), page);
+
+	if(how == HEAP_CREATE && ftruncate(fd, map_size) != 0)
+		return -1;
+
+	// the creator of a shared heap may not have sized it yet
+	for(int waited = 0; how != HEAP_CREATE; waited++)
+	{
+		if(fstat(fd, &st) != 0)
+			return -1;
+		map_size = (size_t) st.st_size;
+		if(map_size > header_bytes)
+			break;
+		if(how != HEAP_ATTACH || waited == ATTACH_WAIT_MS)
+			return -1;
+		usleep(1000);
+	}
+
+	void *map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED)
+		return -1;
+	Header *h = map;
+
+	// the creator sets magic last, once the heap is ready to use
+	for(int waited = 0; how == HEAP_ATTACH &&
+	    __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != HEADER_MAGIC; waited++)
+	{
+		if(waited == ATTACH_WAIT_MS)
+			break;
+		usleep(1000);
+	}
+	if(how != HEAP_CREATE && (h->magic != HEADER_MAGIC || h->header_size != sizeof(Header) ||
+	                          h->pool_size != map_size - header_bytes))
+	{
+		munmap(map, map_size);
+		return -1;
+	}
+
+	alloc_algorithm = algorithm;
+	arena_flags = 0;
+	numa_policy = NUMA_DEFAULT;
+	file_map = map;
+	file_map_size = map_size;
+	file_fd = fd;
+	header = h;
+	ledger = h->ledger;
+
+	pool = (char *) map + header_bytes;
+	pool_size = map_size - header_bytes;
+	chunks[0].base = pool;
+	chunks[0].size = pool_size;
+	chunks[0].backing = SHARED;
+	chunks[0].node = -1;
+	num_chunks = 1;
+	last_chunk_size = pool_size;
+
+	// a fresh file is all zeros, a reopened one already has its ledger.
+	// The lock of a reopened heap may have been held when it was last
+	// closed, nobody else has it open so it is simply reset
+	if(how == HEAP_CREATE)
+	{
+		ledger_init(1);
+		init_lock(h);
+		h->header_size = sizeof(Header);
+		__atomic_store_n(&h->magic, HEADER_MAGIC, __ATOMIC_RELEASE);
+	}
+	else if(how == HEAP_REOPEN)
+	{
+		init_lock(h);
+	}
+	return 0;
+}
+
+int mavalloc_init_file( const char *path, size_t size, enum ALGORITHM algorithm )
+{
+	struct stat st;
+
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd == -1)
+		return -1;
+
+	// an empty file gets a fresh heap, anything else has to be one already
+	if(fstat(fd, &st) != 0 ||
+	   map_heap(fd, size, algorithm, st.st_size == 0 ? HEAP_CREATE : HEAP_REOPEN) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+int mavalloc_init_shared( const char *name, size_t size, enum ALGORITHM algorithm )
+{
+	int fd;
+	enum HEAP_OPEN how = HEAP_CREATE;
+
+	if(name == NULL)
+	{
+		fd = memfd_create("mavalloc", 0);
+	}
+	else
+	{
+		// whoever creates the object writes the heap, everyone else waits
+		// for it and attaches
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if(fd == -1 && errno == EEXIST)
+		{
+			fd = shm_open(name, O_RDWR, 0600);
+			how = HEAP_ATTACH;
+		}
+	}
+	if(fd == -1)
+		return -1;
+
+	if(map_heap(fd, size, algorithm, how) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return 0;
+}
+
+void mavalloc_destroy( )
+{
+	// free the pool allocated, and unmap any chunks the arena grew
+	if(num_chunks > 0 && chunks[0].backing == MALLOCED)
+		free(pool);
+	for(int i = 0; i < num_chunks; i++)
+	{
+		if(chunks[i].backing == MAPPED && chunks[i].base != NULL)
+			munmap(chunks[i].base, chunks[i].size);
+	}
+	// write a file backed heap back and switch to the in-memory header.
+	// A shared heap stays intact for the other processes using it
+	if(file_map != NULL)
+	{
+		msync(file_map, file_map_size, MS_SYNC);
+		munmap(file_map, file_map_size);
+		close(file_fd);
+		file_map = NULL;
+		file_fd = -1;
+		header = &static_header;
+		ledger = static_header.ledger;
+	}
+	for(int i = 0; i < num_large; i++)
+	{
+		munmap(large[i].base, large[i].size);
+	}
+	num_large = 0;
+	large_threshold = LARGE_THRESHOLD;
+	quick_count = 0;
+	adaptive_algorithm = NEXT_FIT;
+	adapt_searches = 0;
+	adapt_failures = 0;
+	adapt_steps = 0;
+	search_steps = 0;
+	pool = NULL;
+	num_chunks = 0;
+	arena_flags = 0;
+	decay_ms = -1;
+	numa_policy = NUMA_DEFAULT;
+	// reset ledger to initial state
+	for(int i = 0; i < MAX_ALLOCS; i++)
+	{
+		ledger[i].offset = 0;
+		ledger[i].size = 0;
+		ledger[i].previous = -1;
+		ledger[i].next = -1;
+	}
+	pool_size = 0;
+	header->ledger_top = -1;
+	header->ledger_head = -1;
+	header->free_slot_top = -1;
+	header->root = -1;
+	header->handle_top = -1;
+	header->free_handle_top = -1;
+	header->live_bytes = 0;
+	header->live_count = 0;
+	header->high_water = 0;
+	header->hole_bytes = 0;
+	header->hole_count = 0;
+	return;
+}
+
+// true if the entry at ptr is a hole of at least size bytes that the
+// running search may use
+static int hole_fits(int ptr, size_t size)
+{
+	return ledger[ptr].type == H && ledger[ptr].size >= size &&
+		(search_node == -1 || chunks[ledger[ptr].chunk].node == search_node);
+}
+
+int first_fit(size_t size)
+{
+	int ptr = traverse_back();
+	while(ptr != -1 && !hole_fits(ptr, size))
+	{
+		ptr = ledger[ptr].next;
+		search_steps++;
+	}
+	return ptr;
+}
+
+int next_fit(size_t size)
+{
+	static int last_ptr = 0;
+	int ptr = last_ptr;
+	while (ptr != -1 && !hole_fits(ptr, size))
+	{
+		ptr = ledger[ptr].next;
+		search_steps++;
+	}
+	if(ptr == -1)
+	{
+		ptr = first_fit(size);
+	}
+	last_ptr = ptr;
+	return ptr;
+}
+
+int worst_fit(size_t size) // take the largest available hole
+{
+	int max_hole_idx = -1;
+	size_t max_hole_size = 0;
+	// the top of the hole heap is the largest hole
+	if(search_node == -1)
+	{
+		search_steps++;
+		max_hole_idx = header->hole_count > 0 ? header->hole_heap[0] : -1;
+		return max_hole_idx != -1 && ledger[max_hole_idx].size >= size ? max_hole_idx : -1;
+	}
+	for(int ptr = traverse_back(); ptr != -1; ptr = ledger[ptr].next)
+	{
+		search_steps++;
+		if(hole_fits(ptr, size) && (max_hole_idx == -1 || ledger[ptr].size > max_hole_size))
+		{
+			max_hole_size = ledger[ptr].size;
+			max_hole_idx = ptr;
+		}
+	}
+	return max_hole_idx;
+}
+
+int best_fit(size_t size) // take the smallest available hole
+{
+	int min_hole_idx = -1;
+	size_t min_hole_size = SIZE_MAX;
+	for (int ptr = traverse_back(); ptr != -1; ptr = ledger[ptr].next)
+	{
+		search_steps++;
+		if (hole_fits(ptr, size) && (min_hole_idx == -1 || ledger[ptr].size < min_hole_size))
+		{
+			min_hole_size = ledger[ptr].size;
+			min_hole_idx = ptr;
+		}
+	}
+	return min_hole_idx;
+}
+
+// share of the free space that lies outside the largest hole
+static double fragmentation_ratio()
+{
+	if(header->hole_bytes == 0)
+		return 0.0;
+	return 1.0 - (double) ledger[header->hole_heap[0]].size / header->hole_bytes;
+}
+
+// picks the algorithm for the next epoch of an ADAPTIVE arena from what
+// the last one saw. Failed searches and fragmented free space call for
+// best fit, which keeps large holes intact. Once free space is in one
+// piece again first fit keeps it that way, and next fit takes over when
+// first fit has to walk far to find room
+static void adapt()
+{
+	double fragmentation = fragmentation_ratio();
+	long average_steps = adapt_steps / adapt_searches;
+
+	if(adapt_failures > 0 || fragmentation > ADAPT_FRAG_HIGH)
+		adaptive_algorithm = BEST_FIT;
+	else if(adaptive_algorithm == BEST_FIT && fragmentation < ADAPT_FRAG_LOW)
+		adaptive_algorithm = FIRST_FIT;
+	else if(adaptive_algorithm == FIRST_FIT && average_steps > ADAPT_LONG_SEARCH)
+		adaptive_algorithm = NEXT_FIT;
+
+	adapt_searches = 0;
+	adapt_failures = 0;
+	adapt_steps = 0;
+}
+
+#ifdef MAVALLOC_INSTRUMENT
+// adds a search of the given algorithm that visited steps nodes to its
+// histogram
+static void count_search(enum ALGORITHM algorithm, long steps, int failed)
+{
+	struct mavalloc_search_counters *c = &counters.algorithm[algorithm];
+	int bucket = 0;
+	while(steps >> bucket && bucket < MAVALLOC_HISTOGRAM_BUCKETS - 1)
+		bucket++;
+	c->searches++;
+	c->nodes_visited += steps;
+	c->failures += failed;
+	c->visits[bucket]++;
+}
+#endif
+
+// searches for a hole of at least size bytes using the algorithm
+// set in mavalloc_init() and returns its index or -1
+static int search_hole(size_t size)
+{
+	int idx = -1;
+	enum ALGORITHM algorithm = alloc_algorithm == ADAPTIVE ? adaptive_algorithm : alloc_algorithm;
+	long steps = search_steps;
+	switch(algorithm)
+	{
+		case FIRST_FIT:
+			idx = first_fit(size);
+			break;
+		case NEXT_FIT:
+			idx = next_fit(size);
+			break;
+		case WORST_FIT:
+			idx = worst_fit(size);
+			break;
+		case BEST_FIT:
+		case ADAPTIVE:
+			idx = best_fit(size);
+			break;
+	}
+	INSTRUMENT(count_search(algorithm, search_steps - steps, idx == -1));
+	if(alloc_algorithm == ADAPTIVE)
+	{
+		adapt_searches++;
+		adapt_steps += search_steps - steps;
+		if(idx == -1)
+			adapt_failures++;
+		if(adapt_searches == ADAPT_EPOCH)
+			adapt();
+	}
+	return idx;
+}
+
+// searches for a hole of at least size bytes. With NUMA_PER_NODE holes on
+// the caller's node are preferred and other nodes are only used if none
+// of them fits
+static int find_hole(size_t size)
+{
+	if(numa_policy != NUMA_PER_NODE)
+		return search_hole(size);
+	search_node = current_numa_node();
+	int idx = search_hole(size);
+	search_node = -1;
+	if(idx == -1)
+		idx = search_hole(size);
+	return idx;
+}
+
+// maps a new chunk that can hold at least size bytes and links it into
+// the ledger as a hole. Chunks grow geometrically so a growing arena
+// needs few of them. With NUMA_PER_NODE the chunk serves the caller's
+// node. returns the index of the new hole or -1
+static int grow_arena(size_t size)
+{
+	if(num_chunks == 0 || ledger_nodes_available() == 0)
+		return -1;
+
+	// reuse the slot of a chunk that was unmapped by purging if there is one
+	int c = 1;
+	while(c < num_chunks && chunks[c].base != NULL)
+	{
+		c++;
+	}
+	if(c == MAX_CHUNKS)
+		return -1;
+
+	size_t chunk_size = last_chunk_size * 2;
+	if(chunk_size < size)
+		chunk_size = size;
+
+	int numa = numa_policy == NUMA_PER_NODE ? current_numa_node() : -1;
+	void *base = map_chunk(&chunk_size, numa);
+	if(base == NULL)
+		return -1;
+
+	chunks[c].base = base;
+	chunks[c].size = chunk_size;
+	chunks[c].backing = MAPPED;
+	chunks[c].node = numa;
+	last_chunk_size = chunk_size;
+	if(c == num_chunks)
+		num_chunks++;
+
+	return link_chunk(c);
+}
+
+// carves size bytes off the front of the hole at idx and returns the index
+// of the new process allocation, or -1 if the ledger has no free slot
+static int split_hole(int idx, size_t size)
+{
+	if(ledger[idx].size == size)
+	{
+		hole_remove(idx);
+		ledger[idx].type = P;
+		ledger[idx].handle = -1;
+		live_insert(idx);
+		return idx;
+	}
+	int node = ledger_node_new();
+	if(node == -1)
+		return -1;
+
+	// allocate memory at the hole in ledger[idx]
+	ledger[node].size = size;
+	ledger[node].type = P;
+	ledger[node].handle = -1;
+	ledger[node].chunk = ledger[idx].chunk;
+	ledger[node].previous = ledger[idx].previous;
+	if(ledger[idx].previous != -1)
+		ledger[ledger[idx].previous].next = node;
+	else
+		header->ledger_head = node;
+	ledger[node].next = idx;
+	ledger[idx].previous = node;
+
+	ledger[idx].size -= size;
+	INSTRUMENT(counters.splits++);
+
+	// hand each side the part of the zeroed range that falls inside it
+	ledger[node].clean_start = ledger[idx].clean_start < size ? ledger[idx].clean_start : size;
+	ledger[node].clean_end = ledger[idx].clean_end < size ? ledger[idx].clean_end : size;
+	ledger[idx].clean_start = ledger[idx].clean_start > size ? ledger[idx].clean_start - size : 0;
+	ledger[idx].clean_end = ledger[idx].clean_end > size ? ledger[idx].clean_end - size : 0;
+
+	ledger[node].offset = ledger[idx].offset;
+
+	ledger[idx].offset += size;
+	hole_resized(idx, ledger[idx].size + size);
+
+	live_insert(node);
+	return node;
+}
+
+// carves size bytes from the hole at idx starting at the first multiple
+// of align in it, leaving the bytes in front as a hole. If the hole is
+// too small to align the block it is carved from the front as usual.
+// returns the index of the new process allocation, or -1
+static int split_hole_aligned(int idx, size_t size, size_t align)
+{
+	size_t pad = (align - (uintptr_t) block_addr(idx) % align) % align;
+	if(pad == 0 || ledger[idx].size < pad + size || ledger_nodes_available() < 2)
+		return split_hole(idx, size);
+
+	// split the padding off as a block and turn it straight into a hole.
+	// It was never handed out, so it does not count towards the high water
+	size_t high_water = header->high_water;
+	int front = split_hole(idx, pad);
+	live_remove(front);
+	header->high_water = high_water;
+	ledger[front].type = H;
+	ledger[front].freed_at = ledger[idx].freed_at;
+	hole_insert(front);
+	return split_hole(idx, size);
+}
+
+// unlinks the entry at i from the list and releases its slot
+static void unlink_node(int i)
+{
+	if(ledger[i].type == H)
+		hole_remove(i);
+	if(ledger[i].previous != -1)
+		ledger[ledger[i].previous].next = ledger[i].next;
+	else
+		header->ledger_head = ledger[i].next;
+	if(ledger[i].next != -1)
+		ledger[ledger[i].next].previous = ledger[i].previous;
+	ledger_node_release(i);
+}
+
+// folds the entry after i into i and releases its slot
+static void merge_next(int i)
+{
+	int victim = ledger[i].next;
+	// only one zeroed range is tracked per entry, keep the larger one
+	if(ledger[victim].clean_end - ledger[victim].clean_start > ledger[i].clean_end - ledger[i].clean_start)
+	{
+		ledger[i].clean_start = ledger[i].size + ledger[victim].clean_start;
+		ledger[i].clean_end = ledger[i].size + ledger[victim].clean_end;
+	}
+	if(ledger[victim].freed_at > ledger[i].freed_at)
+		ledger[i].freed_at = ledger[victim].freed_at;
+	// take the victim out of the hole heap before i changes its key
+	size_t old_size = ledger[i].size;
+	size_t victim_size = ledger[victim].size;
+	unlink_node(victim);
+	ledger[i].size += victim_size;
+	hole_resized(i, old_size);
+}
+
+// true if b is a hole that can be merged into its neighbour a. Holes in
+// different chunks are never merged even if the chunks happen to touch
+static int can_coalesce(int a, int b)
+{
+	return b != -1 && ledger[b].type == H && ledger[b].chunk == ledger[a].chunk;
+}
+
+// hands out an unused handle or -1
+static int handle_new()
+{
+	if(header->free_handle_top >= 0)
+		return header->free_handles[header->free_handle_top--];
+	if(header->handle_top + 1 >= MAX_ALLOCS)
+		return -1;
+	return ++header->handle_top;
+}
+
+static void handle_release(int handle)
+{
+	header->handles[handle] = -1;
+	header->pins[handle] = 0;
+	header->free_handles[++header->free_handle_top] = handle;
+}
+
+// true if handle was handed out and not freed since
+static int handle_valid(int handle)
+{
+	return handle >= 0 && handle <= header->handle_top && header->handles[handle] != -1;
+}
+
+// turns the entry at i, already out of the live accounting, into a hole
+// and coalesces it with its neighbours. returns the index of the
+// resulting hole
+static int make_hole(int i)
+{
+	ledger[i].type = H;
+	ledger[i].clean_start = 0;
+	ledger[i].clean_end = 0;
+	hole_insert(i);
+	if(decay_ms >= 0)
+		ledger[i].freed_at = now_ns();
+	// coalesce backwards
+	if(can_coalesce(i, ledger[i].previous))
+	{
+		i = ledger[i].previous;
+		merge_next(i);
+		INSTRUMENT(counters.backward_coalesces++);
+	}
+	// coalesce forward
+	if(can_coalesce(i, ledger[i].next))
+	{
+		merge_next(i);
+		INSTRUMENT(counters.forward_coalesces++);
+	}
+	return i;
+}
+
+// turns the allocation at i into a hole and coalesces it with its
+// neighbours, returns the index of the resulting hole
+static int release_block(int i)
+{
+	live_remove(i);
+	if(i == header->root)
+		header->root = -1;
+	if(ledger[i].handle != -1)
+		handle_release(ledger[i].handle);
+	return make_hole(i);
+}
+
+// returns the pages of the hole at i to the OS. A grown chunk that ends
+// in the hole is unmapped from the first page boundary in the hole, the
+// remaining page aligned interior is dropped with madvise and then reads
+// back as zero. Pages of a file backed arena are removed from the file.
+// returns the number of bytes purged
+static size_t purge_hole(int i)
+{
+	size_t page = (size_t) sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t) block_addr(i);
+	uintptr_t end = start + ledger[i].size;
+	uintptr_t first_page = (start + page - 1) / page * page;
+	uintptr_t last_page = end / page * page;
+	Chunk *chunk = &chunks[ledger[i].chunk];
+	size_t purged = 0;
+
+	// trim a trailing hole off a chunk we grew ourselves, as long as the
+	// arena can grow back into the space. Chunk 0 is the pool, which
+	// offsets and pointers are taken against, so it stays mapped
+	if(ledger[i].chunk != 0 && chunk->backing == MAPPED && (arena_flags & MAVALLOC_GROW) && end == (uintptr_t) chunk->base + chunk->size && first_page < end)
+	{
+		purged = end - first_page;
+		if(munmap((void *) first_page, purged) != 0)
+			return 0;
+		chunk->size -= purged;
+		if(chunk->size == 0)
+			chunk->base = NULL;
+		if(first_page == start)
+		{
+			unlink_node(i);
+			return purged;
+		}
+		ledger[i].size = first_page - start;
+		hole_resized(i, end - start);
+		if(ledger[i].clean_end > ledger[i].size)
+			ledger[i].clean_end = ledger[i].size;
+		if(ledger[i].clean_start > ledger[i].clean_end)
+			ledger[i].clean_start = ledger[i].clean_end;
+		return purged;
+	}
+
+	if(last_page <= first_page)
+		return 0;
+	size_t clean_start = first_page - start;
+	size_t clean_end = last_page - start;
+	if(ledger[i].clean_start <= clean_start && ledger[i].clean_end >= clean_end)
+		return 0;
+	int advice = chunk->backing == SHARED ? MADV_REMOVE : MADV_DONTNEED;
+	if(madvise((void *) first_page, last_page - first_page, advice) != 0)
+		return 0;
+	ledger[i].clean_start = clean_start;
+	ledger[i].clean_end = clean_end;
+	return last_page - first_page;
+}
+
+// purges every hole that has been free for the decay time
+static size_t purge_all()
+{
+	if(decay_ms < 0)
+		return 0;
+	long long now = now_ns();
+	long long decay_ns = (long long) decay_ms * 1000000LL;
+	size_t purged = 0;
+	int i = traverse_back();
+	while(i != -1)
+	{
+		int next = ledger[i].next;
+		if(ledger[i].type == H && now - ledger[i].freed_at >= decay_ns)
+		{
+			purged += purge_hole(i);
+		}
+		i = next;
+	}
+	next_purge_ns = now + decay_ns;
+	return purged;
+}
+
+size_t mavalloc_purge( )
+{
+	arena_lock();
+	size_t purged = purge_all();
+	arena_unlock();
+	return purged;
+}
+
+void mavalloc_set_decay( long ms )
+{
+	arena_lock();
+	// holes are only stamped while decay is on, so the ones freed before
+	// it was turned on start their decay now
+	if(decay_ms < 0 && ms >= 0)
+	{
+		long long now = now_ns();
+		for(int i = traverse_back(); i != -1; i = ledger[i].next)
+		{
+			if(ledger[i].type == H)
+				ledger[i].freed_at = now;
+		}
+	}
+	decay_ms = ms < 0 ? -1 : ms;
+	next_purge_ns = 0;
+	arena_unlock();
+}
+
+// runs a purge pass from the free path at most once per decay period
+static void maybe_purge()
+{
+	if(decay_ms >= 0 && now_ns() >= next_purge_ns)
+		purge_all();
+}
+
+// true if an allocation of size bytes bypasses the ledger
+static int is_large(size_t size)
+{
+	return (arena_flags & MAVALLOC_LARGE) && size >= large_threshold;
+}
+
+// maps a region of its own for size bytes, NULL if the table is full
+static void *alloc_large(size_t size)
+{
+	if(num_large == MAX_LARGE)
+		return NULL;
+	void *base = map_chunk(&size, numa_policy == NUMA_PER_NODE ? current_numa_node() : -1);
+	if(base == NULL)
+		return NULL;
+	large[num_large].base = base;
+	large[num_large].size = size;
+	num_large++;
+	return base;
+}
+
+// unmaps ptr if it is a large object, returns 1 if it was one
+static int free_large(void *ptr)
+{
+	// large objects start on a page, so most pointers are ruled out here
+	if(num_large == 0 || (uintptr_t) ptr % (uintptr_t) sysconf(_SC_PAGESIZE) != 0)
+		return 0;
+	for(int i = 0; i < num_large; i++)
+	{
+		if(large[i].base == ptr)
+		{
+			if(trace_fd != -1)
+				trace_event(MAVALLOC_TRACE_FREE, large[i].size, ptr, -1, 0);
+			munmap(large[i].base, large[i].size);
+			large[i] = large[--num_large];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// true if blocks of an aligned size go through the quick bins
+static int quick_fit(size_t size)
+{
+	return (arena_flags & MAVALLOC_QUICKFIT) && size > 0 && size <= QUICK_MAX;
+}
+
+// frees the small allocation at i into the quick bin of its size,
+// leaving it out of the ledger's holes so the next allocation of that
+// size can take it straight back
+static void bin_push(int i)
+{
+	live_remove(i);
+	if(i == header->root)
+		header->root = -1;
+	if(ledger[i].handle != -1)
+		handle_release(ledger[i].handle);
+	ledger[i].handle = -1;
+	ledger[i].type = Q;
+	ledger[i].clean_start = 0;
+	ledger[i].clean_end = 0;
+	int bin = ledger[i].size / 4 - 1;
+	ledger[i].bucket_next = quick_bins[bin];
+	quick_bins[bin] = i;
+	quick_count++;
+}
+
+// takes the most recently freed block of an aligned size from its quick
+// bin, or -1 if the bin is empty
+static int bin_pop(size_t size)
+{
+	int bin = size / 4 - 1;
+	int i = quick_bins[bin];
+	if(i == -1)
+		return -1;
+	quick_bins[bin] = ledger[i].bucket_next;
+	quick_count--;
+	ledger[i].type = P;
+	live_insert(i);
+	return i;
+}
+
+// returns every block in the quick bins to the ledger as a hole. Binned
+// blocks already left the live accounting when they were pushed
+static void flush_bins()
+{
+	for(int bin = 0; bin < QUICK_BINS; bin++)
+	{
+		while(quick_bins[bin] != -1)
+		{
+			int i = quick_bins[bin];
+			quick_bins[bin] = ledger[i].bucket_next;
+			quick_count--;
+			make_hole(i);
+		}
+	}
+}
+
+// frees the allocation at i, into its quick bin if it is small enough.
+// returns the index of the entry the block ended up in
+static int free_node(int i)
+{
+	if(quick_fit(ledger[i].size))
+	{
+		bin_push(i);
+		return i;
+	}
+	return release_block(i);
+}
+
+// finds a hole of at least size bytes, growing the arena if it is
+// allowed to and nothing fits
+static int find_or_grow(size_t size)
+{
+	int idx = find_hole(size);
+	// blocks sitting in the quick bins may coalesce into a hole that fits
+	if(idx == -1 && quick_count > 0)
+	{
+		flush_bins();
+		idx = find_hole(size);
+	}
+	if(idx == -1 && (arena_flags & MAVALLOC_GROW))
+		idx = grow_arena(size);
+	return idx;
+}
+
+// allocates an aligned size and returns the ledger index of the block or -1
+static int alloc_node(size_t size)
+{
+	if(quick_fit(size))
+	{
+		int i = bin_pop(size);
+		if(i != -1)
+			return i;
+	}
+
+	// keep huge page sized blocks on huge page boundaries so they do not
+	// straddle more huge pages than they need to. Look for a hole with
+	// room to align first and settle for any hole that fits otherwise
+	if((arena_flags & MAVALLOC_HUGEPAGES) && size >= HUGE_PAGE_SIZE)
+	{
+		int idx = find_hole(size + HUGE_PAGE_SIZE - 4);
+		if (idx == -1)
+			idx = find_or_grow(size);
+		if (idx == -1)
+			return -1;
+		return split_hole_aligned(idx, size, HUGE_PAGE_SIZE);
+	}
+
+	// get the index of the hole in which memory will be allocated
+	// based on the algorithm global set
+	int idx = find_or_grow(size);
+	// only return -1 on failure
+	if (idx == -1)
+		return -1;
+
+	return split_hole(idx, size);
+}
+
+void * mavalloc_alloc( size_t size )
+{
+	void *block = NULL;
+	int node = -1;
+	arena_lock();
+	long steps = search_steps;
+	if(is_large(size))
+		block = alloc_large(size);
+	if(block == NULL)
+	{
+		node = alloc_node(ALIGN4(size));
+		block = node == -1 ? NULL : block_addr(node);
+	}
+	INSTRUMENT(counters.failed_allocations += block == NULL);
+	if(trace_fd != -1)
+		trace_event(MAVALLOC_TRACE_ALLOC, size, block, node, search_steps - steps);
+	arena_unlock();
+	return block;
+}
+
+void mavalloc_set_large_threshold( size_t bytes )
+{
+	arena_lock();
+	large_threshold = bytes;
+	arena_unlock();
+}
+
+void * mavalloc_calloc( size_t n, size_t size )
+{
+	if(size != 0 && n > SIZE_MAX / size)
+		return NULL;
+	arena_lock();
+	long steps = search_steps;
+	// fresh mappings are already zero
+	if(is_large(n * size))
+	{
+		void *block = alloc_large(n * size);
+		if(block != NULL)
+		{
+			if(trace_fd != -1)
+				trace_event(MAVALLOC_TRACE_ALLOC, n * size, block, -1, 0);
+			arena_unlock();
+			return block;
+		}
+	}
+	int node = alloc_node(ALIGN4(n * size));
+	if(trace_fd != -1)
+		trace_event(MAVALLOC_TRACE_ALLOC, n * size, node == -1 ? NULL : block_addr(node), node, search_steps - steps);
+	if (node == -1)
+	{
+		INSTRUMENT(counters.failed_allocations++);
+		arena_unlock();
+		return NULL;
+	}
+	char *block = block_addr(node);
+	size_t block_size = ledger[node].size;
+	size_t clean_start = ledger[node].clean_start;
+	size_t clean_end = ledger[node].clean_end;
+	arena_unlock();
+
+	// purged pages already read as zero, only clear around them
+	if(clean_start >= clean_end)
+	{
+		memset(block, 0, block_size);
+	}
+	else
+	{
+		memset(block, 0, clean_start);
+		memset(block + clean_end, 0, block_size - clean_end);
+	}
+	return block;
+}
+
+// returns the ledger index of the allocation starting at ptr or -1.
+// Only blocks whose address hashes alike have to be compared
+static int find_block(void *ptr)
+{
+	size_t offset;
+	int chunk = locate(ptr, &offset);
+	if(chunk == -1)
+		return -1;
+	int i = header->live_buckets[live_bucket(chunk, offset)];
+	while(i != -1 && (ledger[i].offset != offset || ledger[i].chunk != chunk))
+	{
+		i = ledger[i].bucket_next;
+	}
+	return i;
+}
+
+void * mavalloc_alloc_aligned( size_t size, size_t align )
+{
+	if(align == 0 || (align & (align - 1)) != 0 || size > SIZE_MAX - align)
+		return NULL;
+	if(align <= 4)
+		return mavalloc_alloc(size);
+	arena_lock();
+	long steps = search_steps;
+	void *block = NULL;
+	int node = -1;
+	// large objects start on a page boundary
+	if(is_large(size) && align <= (size_t) sysconf(_SC_PAGESIZE))
+		block = alloc_large(size);
+	if(block == NULL)
+	{
+		// a hole with align - 4 bytes to spare has room to align the block
+		// since every block starts on a multiple of 4
+		int idx = find_or_grow(ALIGN4(size) + align - 4);
+		if(idx != -1)
+			node = split_hole_aligned(idx, ALIGN4(size), align);
+		// split_hole_aligned carves from the front when it runs out of
+		// ledger slots for the padding
+		if(node != -1 && (uintptr_t) block_addr(node) % align != 0)
+		{
+			release_block(node);
+			node = -1;
+		}
+		block = node == -1 ? NULL : block_addr(node);
+	}
+	INSTRUMENT(counters.failed_allocations += block == NULL);
+	if(trace_fd != -1)
+		trace_event(MAVALLOC_TRACE_ALLOC, size, block, node, search_steps - steps);
+	arena_unlock();
+	return block;
+}
+
+size_t mavalloc_usable_size( void * ptr )
+{
+	size_t size = 0;
+	if(!ptr)
+		return 0;
+	arena_lock();
+	for(int i = 0; i < num_large; i++)
+	{
+		if(large[i].base == ptr)
+			size = large[i].size;
+	}
+	int i = size == 0 ? find_block(ptr) : -1;
+	if(i != -1 && ledger[i].type == P)
+		size = ledger[i].size;
+	arena_unlock();
+	return size;
+}
+
+// carves n blocks of an aligned size for mavalloc_alloc_batch
+static size_t alloc_batch(size_t n, size_t size, void **out)
+{
+	size_t done = 0;
+
+	// one search for a hole that takes the whole batch, then carve the
+	// blocks back to back from its front. Growing the arena may use up a
+	// ledger slot, so the carving stops once the ledger runs out
+	if(size != 0 && n <= SIZE_MAX / size && ledger_nodes_available() >= n)
+	{
+		int idx = find_or_grow(n * size);
+		for(; idx != -1 && done < n; done++)
+		{
+			int node = split_hole(idx, size);
+			if(node == -1)
+				break;
+			out[done] = block_addr(node);
+		}
+	}
+
+	// no single hole is large enough, satisfy what we can one at a time
+	for(; done < n; done++)
+	{
+		int node = alloc_node(size);
+		if(node == -1)
+			break;
+		out[done] = block_addr(node);
+	}
+	for(size_t i = done; i < n; i++)
+	{
+		out[i] = NULL;
+	}
+	return done;
+}
+
+size_t mavalloc_alloc_batch( size_t n, size_t size, void **out )
+{
+	if(n == 0 || out == NULL)
+		return 0;
+	arena_lock();
+	long steps = search_steps;
+	size_t done = alloc_batch(n, ALIGN4(size), out);
+	INSTRUMENT(counters.failed_allocations += n - done);
+	// the one search is put down to the first block
+	for(size_t i = 0; trace_fd != -1 && i < n; i++)
+	{
+		trace_event(MAVALLOC_TRACE_ALLOC, size, out[i], out[i] ? find_block(out[i]) : -1, i == 0 ? search_steps - steps : 0);
+	}
+	arena_unlock();
+	return done;
+}
+
+// frees the block starting at ptr if there is one
+// frees the arena block starting at ptr, returns 0 if there is none.
+// size is what the caller says it allocated, 0 if it does not know
+static int free_arena_block(void *ptr, size_t size)
+{
+	int i = find_block(ptr);
+	if(i == -1 || ledger[i].type != P)
+		return 0;
+	INSTRUMENT(counters.sized_free_mismatches += size != 0 && ALIGN4(size) > ledger[i].size);
+	if(trace_fd != -1)
+		trace_event(MAVALLOC_TRACE_FREE, ledger[i].size, ptr, i, 0);
+	free_node(i);
+	maybe_purge();
+	return 1;
+}
+
+// frees the block starting at ptr if there is one
+static void free_block(void *ptr)
+{
+	if(!free_large(ptr))
+		free_arena_block(ptr, 0);
+}
+
+void mavalloc_free( void * ptr )
+{
+	if(!ptr)
+		return;
+	arena_lock();
+	free_block(ptr);
+	arena_unlock();
+}
+
+int mavalloc_free_owned( void * ptr )
+{
+	if(!ptr)
+		return 0;
+	arena_lock();
+	int freed = free_large(ptr) || free_arena_block(ptr, 0);
+	arena_unlock();
+	return freed;
+}
+
+void mavalloc_free_sized( void * ptr, size_t size )
+{
+	if(!ptr)
+		return;
+	arena_lock();
+	// a size below the large object threshold goes straight to the
+	// ledger. The large objects are only scanned if the block is not
+	// there, as after the threshold was raised
+	if(is_large(size))
+		free_block(ptr);
+	else if(!free_arena_block(ptr, size))
+		free_large(ptr);
+	arena_unlock();
+}
+
+// sorts n keys in place with an LSD radix sort on 8 bit digits, only
+// running as many passes as max needs
+static void radix_sort(uintptr_t *keys, uintptr_t *scratch, size_t n, uintptr_t max)
+{
+	uintptr_t *src = keys;
+	uintptr_t *dst = scratch;
+	for(unsigned shift = 0; shift < sizeof(uintptr_t) * CHAR_BIT && (max >> shift) != 0; shift += 8)
+	{
+		size_t count[257] = { 0 };
+		for(size_t i = 0; i < n; i++)
+		{
+			count[((src[i] >> shift) & 0xff) + 1]++;
+		}
+		for(int d = 0; d < 256; d++)
+		{
+			count[d + 1] += count[d];
+		}
+		for(size_t i = 0; i < n; i++)
+		{
+			dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+		}
+		uintptr_t *tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+	if(src != keys)
+		memcpy(keys, src, n * sizeof(uintptr_t));
+}
+
+// frees every block in ptrs in one sweep of the ledger
+static void free_batch(void **ptrs, size_t n)
+{
+	uintptr_t *keys = malloc(2 * n * sizeof(uintptr_t));
+	if(keys == NULL)
+	{
+		// no room to sort, free them one by one instead
+		for(size_t i = 0; i < n; i++)
+		{
+			if(ptrs[i])
+				free_block(ptrs[i]);
+		}
+		return;
+	}
+
+	// sort the pointers by their offset from the lowest one
+	size_t count = 0;
+	uintptr_t base = UINTPTR_MAX;
+	uintptr_t top = 0;
+	for(size_t i = 0; i < n; i++)
+	{
+		if(ptrs[i] == NULL || free_large(ptrs[i]))
+			continue;
+		uintptr_t addr = (uintptr_t) ptrs[i];
+		if(addr < base)
+			base = addr;
+		if(addr > top)
+			top = addr;
+		keys[count++] = addr;
+	}
+	for(size_t k = 0; k < count; k++)
+	{
+		keys[k] -= base;
+	}
+	radix_sort(keys, keys + n, count, top - base);
+
+	// the ledger is in address order, so one forward sweep meets every
+	// pointer in turn. Freeing a block coalesces it with the hole left
+	// behind by the previous one and the sweep carries on from there
+	size_t k = 0;
+	for(int i = traverse_back(); i != -1 && k < count; i = ledger[i].next)
+	{
+		uintptr_t addr = (uintptr_t) block_addr(i);
+		// skip pointers that do not start a block
+		while(k < count && keys[k] + base < addr)
+		{
+			k++;
+		}
+		if(k < count && keys[k] + base == addr)
+		{
+			if(ledger[i].type == P)
+			{
+				if(trace_fd != -1)
+					trace_event(MAVALLOC_TRACE_FREE, ledger[i].size, block_addr(i), i, 0);
+				i = free_node(i);
+			}
+			k++;
+		}
+	}
+	free(keys);
+	maybe_purge();
+}
+
+void mavalloc_free_batch( void **ptrs, size_t n )
+{
+	if(ptrs == NULL || n == 0)
+		return;
+	arena_lock();
+	free_batch(ptrs, n);
+	arena_unlock();
+}
+
+int mavalloc_halloc( size_t size )
+{
+	int handle = -1;
+	arena_lock();
+	long steps = search_steps;
+	int node = alloc_node(ALIGN4(size));
+	if(node != -1)
+	{
+		handle = handle_new();
+		if(handle == -1)
+		{
+			release_block(node);
+		}
+		else
+		{
+			header->handles[handle] = node;
+			header->pins[handle] = 0;
+			ledger[node].handle = handle;
+		}
+	}
+	INSTRUMENT(counters.failed_allocations += handle == -1);
+	if(trace_fd != -1)
+		trace_event(MAVALLOC_TRACE_ALLOC, size, handle == -1 ? NULL : block_addr(node),
+		            handle == -1 ? -1 : node, search_steps - steps);
+	arena_unlock();
+	return handle;
+}
+
+void * mavalloc_hpin( int handle )
+{
+	void *block = NULL;
+	arena_lock();
+	if(handle_valid(handle))
+	{
+		header->pins[handle]++;
+		block = block_addr(header->handles[handle]);
+	}
+	arena_unlock();
+	return block;
+}
+
+void mavalloc_hunpin( int handle )
+{
+	arena_lock();
+	if(handle_valid(handle) && header->pins[handle] > 0)
+		header->pins[handle]--;
+	arena_unlock();
+}
+
+void mavalloc_hfree( int handle )
+{
+	arena_lock();
+	if(handle_valid(handle))
+	{
+		int i = header->handles[handle];
+		if(trace_fd != -1)
+			trace_event(MAVALLOC_TRACE_FREE, ledger[i].size, block_addr(i), i, 0);
+		free_node(i);
+		maybe_purge();
+	}
+	arena_unlock();
+}
+
+// true if compaction may move the block at i. Huge page aligned blocks
+// stay put so they keep their alignment
+static int movable(int i)
+{
+	return ledger[i].type == P && ledger[i].handle != -1 && header->pins[ledger[i].handle] == 0 &&
+		!((arena_flags & MAVALLOC_HUGEPAGES) && ledger[i].size >= HUGE_PAGE_SIZE);
+}
+
+// moves the block at b down into the hole h right in front of it, so the
+// hole ends up behind the block
+static void slide_block(int h, int b)
+{
+	live_remove(b);
+	memmove(block_addr(h), block_addr(b), ledger[b].size);
+	ledger[b].offset = ledger[h].offset;
+	ledger[h].offset += ledger[b].size;
+	hole_resized(h, ledger[h].size);
+	// the block was copied over the hole's pages
+	ledger[h].clean_start = 0;
+	ledger[h].clean_end = 0;
+
+	// swap the two entries in the list
+	int prev = ledger[h].previous;
+	int next = ledger[b].next;
+	if(prev != -1)
+		ledger[prev].next = b;
+	else
+		header->ledger_head = b;
+	if(next != -1)
+		ledger[next].previous = h;
+	ledger[b].previous = prev;
+	ledger[b].next = h;
+	ledger[h].previous = b;
+	ledger[h].next = next;
+	live_insert(b);
+}
+
+size_t mavalloc_compact( size_t max_bytes )
+{
+	size_t moved = 0;
+	arena_lock();
+	if(quick_count > 0)
+		flush_bins();
+	int h = traverse_back();
+	while(h != -1)
+	{
+		int b = ledger[h].next;
+		// only a hole with a movable block behind it in the same chunk
+		// lets anything slide
+		if(ledger[h].type != H || b == -1 || ledger[b].chunk != ledger[h].chunk || !movable(b))
+		{
+			h = b;
+			continue;
+		}
+		// always move one block so every call makes progress
+		if(max_bytes != 0 && moved != 0 && moved + ledger[b].size > max_bytes)
+			break;
+		moved += ledger[b].size;
+		// a trace sees the move as a free of the old block and an
+		// allocation of the new one
+		if(trace_fd != -1)
+			trace_event(MAVALLOC_TRACE_FREE, ledger[b].size, block_addr(b), b, 0);
+		slide_block(h, b);
+		if(trace_fd != -1)
+			trace_event(MAVALLOC_TRACE_ALLOC, ledger[b].size, block_addr(b), b, 0);
+		// the hole now touches whatever followed the block
+		if(can_coalesce(h, ledger[h].next))
+			merge_next(h);
+	}
+	arena_unlock();
+	return moved;
+}
+
+void mavalloc_set_root( void * ptr )
+{
+	arena_lock();
+	int i = ptr ? find_block(ptr) : -1;
+	header->root = (i != -1 && ledger[i].type == P) ? i : -1;
+	arena_unlock();
+}
+
+void * mavalloc_get_root( )
+{
+	arena_lock();
+	void *root = header->root == -1 ? NULL : block_addr(header->root);
+	arena_unlock();
+	return root;
+}
+
+size_t mavalloc_offset( void * ptr )
+{
+	if(pool == NULL || (uintptr_t) ptr < (uintptr_t) pool || (uintptr_t) ptr >= (uintptr_t) pool + pool_size)
+		return SIZE_MAX;
+	return (uintptr_t) ptr - (uintptr_t) pool;
+}
+
+void * mavalloc_pointer( size_t offset )
+{
+	if(pool == NULL || offset >= pool_size)
+		return NULL;
+	return (char *) pool + offset;
+}
+
+enum ALGORITHM mavalloc_algorithm( )
+{
+	arena_lock();
+	enum ALGORITHM algorithm = alloc_algorithm == ADAPTIVE ? adaptive_algorithm : alloc_algorithm;
+	arena_unlock();
+	return algorithm;
+}
+
+void mavalloc_stats( struct mavalloc_stats *stats )
+{
+	arena_lock();
+	stats->bytes_allocated = header->live_bytes;
+	stats->bytes_free = header->hole_bytes;
+	stats->holes = header->hole_count;
+	stats->live_blocks = header->live_count;
+	stats->largest_hole = header->hole_count > 0 ? ledger[header->hole_heap[0]].size : 0;
+	stats->fragmentation = fragmentation_ratio();
+	stats->high_water = header->high_water;
+	arena_unlock();
+}
+
+int mavalloc_counters( struct mavalloc_counters *out )
+{
+#ifdef MAVALLOC_INSTRUMENT
+	arena_lock();
+	*out = counters;
+	arena_unlock();
+	return 0;
+#else
+	memset(out, 0, sizeof(*out));
+	return -1;
+#endif
+}
+
+void mavalloc_reset_counters( )
+{
+#ifdef MAVALLOC_INSTRUMENT
+	arena_lock();
+	memset(&counters, 0, sizeof(counters));
+	arena_unlock();
+#endif
+}
+
+int mavalloc_trace_start( const char *path )
+{
+	struct mavalloc_trace_header trace_header = { MAVALLOC_TRACE_MAGIC, MAVALLOC_TRACE_VERSION,
+	                                              sizeof(struct mavalloc_trace_record) };
+	if(trace_fd != -1)
+		return -1;
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if(fd == -1)
+		return -1;
+	if(write(fd, &trace_header, sizeof(trace_header)) != sizeof(trace_header))
+	{
+		close(fd);
+		return -1;
+	}
+	trace_fd = fd;
+	return 0;
+}
+
+void mavalloc_trace_stop( )
+{
+	if(trace_fd == -1)
+		return;
+	pthread_mutex_lock(&trace_lock);
+	for(TraceRing *ring = trace_rings; ring != NULL; ring = ring->next)
+	{
+		trace_flush(ring);
+	}
+	close(trace_fd);
+	trace_fd = -1;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+// allocations record trace events with the arena lock held, so the trace
+// lock is taken second
+void mavalloc_fork_prepare( )
+{
+	arena_lock();
+	pthread_mutex_lock(&trace_lock);
+}
+
+void mavalloc_fork_parent( )
+{
+	pthread_mutex_unlock(&trace_lock);
+	arena_unlock();
+}
+
+// the child's only thread is not the owner the locks remember, so they
+// are set up afresh. The lock of a shared heap is the parent's to release
+void mavalloc_fork_child( )
+{
+	pthread_mutex_init(&trace_lock, NULL);
+	if(file_map == NULL)
+		pthread_mutex_init(&header->lock, NULL);
+}
+
+int mavalloc_size( )
+{
+	int number_of_nodes = 0;
+	
+	arena_lock();
 	for(int i = traverse_back(); i >= 0; i = ledger[i].next)
 	{
 		number_of_nodes++;
 	}
+	arena_unlock();
 
 	return number_of_nodes;
 }
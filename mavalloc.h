@@ -31,9 +31,30 @@ enum ALGORITHM
   NEXT_FIT = 0,
   BEST_FIT,
   WORST_FIT,
-  FIRST_FIT
+  FIRST_FIT,
+  ADAPTIVE // switches between the others as the workload changes
 }; 
 
+enum MAVALLOC_FLAG
+{
+  MAVALLOC_GROW = 1 << 0,
+  MAVALLOC_MMAP = 1 << 1,
+  MAVALLOC_HUGEPAGES = 1 << 2,
+  MAVALLOC_PREFAULT = 1 << 3,
+  MAVALLOC_MLOCK = 1 << 4,
+  MAVALLOC_LARGE = 1 << 5,
+  MAVALLOC_QUICKFIT = 1 << 6
+};
+
+enum NUMA_POLICY
+{
+  NUMA_DEFAULT = 0,
+  NUMA_BIND,
+  NUMA_INTERLEAVE,
+  NUMA_LOCAL,
+  NUMA_PER_NODE
+};
+
 /**
  * @brief Initialize the allocation arena and set the algorithm type
  *
@@ -43,6 +64,13 @@ enum ALGORITHM
  * If the allocation succeeds it returns 0. If the allocation fails or the 
  * size is less than 0 the function returns -1
  *
+ * ADAPTIVE starts out as NEXT_FIT and every 1024 searches picks the
+ * algorithm for the next ones from what it saw: BEST_FIT while searches
+ * fail or more than half the free space is outside the largest hole,
+ * FIRST_FIT once free space is back in one piece, and NEXT_FIT when
+ * first fit searches get long. All of them share the ledger, so
+ * switching costs nothing. WORST_FIT is never picked.
+ *
  * \param size The size of the pool to allocate in bytes
  * \param algorithm The heap algorithm to implement
  * \return 0 on success. -1 on failure
@@ -50,6 +78,132 @@ enum ALGORITHM
 int mavalloc_init( size_t size, enum ALGORITHM algorithm );
 
 
+/**
+ * @brief Initialize the allocation arena with optional behaviour flags
+ *
+ * Works like mavalloc_init but also takes a bitwise OR of MAVALLOC_FLAG
+ * values. mavalloc_init( size, algorithm ) is the same as passing 0.
+ *
+ * MAVALLOC_GROW: when no hole fits an allocation the arena maps another
+ * chunk with mmap instead of failing. Each chunk is at least twice the
+ * size of the one before it, so the pool can start small. Holes in
+ * different chunks are never coalesced.
+ *
+ * MAVALLOC_MMAP: the pool is mapped with mmap instead of malloc and its
+ * size is rounded up to whole pages.
+ *
+ * MAVALLOC_HUGEPAGES: like MAVALLOC_MMAP, but the pool and any grown
+ * chunks are rounded up to and aligned on 2 MB huge pages. Reserved huge
+ * pages (MAP_HUGETLB) are used when available, otherwise the kernel is
+ * asked for transparent huge pages with madvise(MADV_HUGEPAGE).
+ * Allocations of a huge page or more are placed on a huge page boundary
+ * when the hole they go in has room for it.
+ *
+ * MAVALLOC_PREFAULT: like MAVALLOC_MMAP, but every page of the pool and
+ * of grown chunks is faulted in while it is mapped (MAP_POPULATE), so
+ * first use of the memory does not take page faults.
+ *
+ * MAVALLOC_MLOCK: like MAVALLOC_MMAP, but the pool and grown chunks are
+ * locked into RAM with mlock. Initialization fails if they cannot be
+ * locked, for example because of RLIMIT_MEMLOCK.
+ *
+ * MAVALLOC_LARGE: mavalloc_alloc and mavalloc_calloc requests of 256 KB
+ * or more (see mavalloc_set_large_threshold) skip the ledger and get a
+ * page aligned mapping of their own, which mavalloc_free unmaps again.
+ * They do not count towards the pool size or mavalloc_size. Up to 128
+ * large objects are mapped at once, beyond that they come from the pool.
+ *
+ * MAVALLOC_QUICKFIT: freed blocks of up to 256 bytes are kept on a LIFO
+ * list per size instead of being coalesced, and allocations of that size
+ * take the most recently freed one before searching the arena. Binned
+ * blocks still count in mavalloc_size. They are returned to the arena
+ * as holes when a search finds nothing or the arena is compacted.
+ *
+ * \param size The size of the pool to allocate in bytes
+ * \param algorithm The heap algorithm to implement
+ * \param flags Bitwise OR of MAVALLOC_FLAG values
+ * \return 0 on success. -1 on failure
+ **/
+int mavalloc_init_flags( size_t size, enum ALGORITHM algorithm, int flags );
+
+
+/**
+ * @brief Initialize the allocation arena with a NUMA placement policy
+ *
+ * Works like mavalloc_init_flags but maps the pool with mmap and places
+ * it on NUMA nodes according to policy:
+ *
+ * NUMA_DEFAULT: no policy, the same as mavalloc_init_flags.
+ * NUMA_BIND: all memory is bound to node.
+ * NUMA_INTERLEAVE: pages are interleaved across all online nodes.
+ * NUMA_LOCAL: memory prefers the node of the CPU calling this function.
+ * NUMA_PER_NODE: the size is split into one pool per online node, each bound to
+ * its node. Allocations are served from the pool of the node the calling
+ * thread runs on and only spill to other nodes when it has no hole that
+ * fits. With MAVALLOC_GROW, grown chunks serve the caller's node.
+ *
+ * node is only used by NUMA_BIND. On machines without NUMA there is a
+ * single node and every policy behaves like NUMA_DEFAULT.
+ *
+ * \param size The size of the pool to allocate in bytes
+ * \param algorithm The heap algorithm to implement
+ * \param flags Bitwise OR of MAVALLOC_FLAG values
+ * \param policy The NUMA placement policy
+ * \param node The node for NUMA_BIND
+ * \return 0 on success. -1 on failure or if node is not online
+ **/
+int mavalloc_init_numa( size_t size, enum ALGORITHM algorithm, int flags,
+                        enum NUMA_POLICY policy, int node );
+
+
+/**
+ * @brief Initialize the allocation arena in a file
+ *
+ * This function maps the file at path and uses it as the pool. The
+ * ledger is stored at the start of the file using offsets rather than
+ * addresses, so the heap survives the process: calling this again on
+ * the same file maps the heap back with every block where it was,
+ * without rebuilding anything. mavalloc_destroy writes the heap back to
+ * the file.
+ *
+ * If the file is empty or does not exist a new heap of size bytes is
+ * created. An existing heap is reopened at the size it was created with
+ * and size is ignored. Data structures kept in the heap should link
+ * their blocks with mavalloc_offset / mavalloc_pointer, since the file
+ * may be mapped at another address next time, and can be found again
+ * through mavalloc_set_root / mavalloc_get_root.
+ *
+ * \param path The heap file
+ * \param size The size of the pool to create in bytes
+ * \param algorithm The heap algorithm to implement
+ * \return 0 on success. -1 on failure or if the file is not a heap
+ **/
+int mavalloc_init_file( const char *path, size_t size, enum ALGORITHM algorithm );
+
+/**
+ * @brief Initialize the allocation arena in shared memory
+ *
+ * This function places the arena in the POSIX shared memory object
+ * name, laid out like a file backed arena, so several processes can
+ * allocate from one region and pass blocks to each other by offset
+ * (mavalloc_offset / mavalloc_pointer) without copying. Every process
+ * calls this with the same name: the first one creates a heap of size
+ * bytes, the others wait for it and attach. The arena functions take a
+ * process shared lock, so all of them may be used concurrently.
+ *
+ * With a NULL name the heap is placed in an anonymous memfd instead,
+ * which processes forked after this call share. mavalloc_destroy only
+ * detaches the calling process; remove the object with shm_unlink
+ * once everyone is done with it. Shared arenas do not grow.
+ *
+ * \param name The shared memory object, "/name", or NULL
+ * \param size The size of the pool to create in bytes
+ * \param algorithm The heap algorithm to implement
+ * \return 0 on success. -1 on failure or if the object is not a heap
+ **/
+int mavalloc_init_shared( const char *name, size_t size, enum ALGORITHM algorithm );
+
+
 /**
  * @brief Destroy the arena 
  *
@@ -70,13 +224,76 @@ void mavalloc_destroy( );
  * The function searches the arena for a free block using the heap allocation algorithm 
  * specified when the arena was allocated.
  *
- * If there is no available block of memory the function returns NULL
+ * If there is no available block of memory the function returns NULL,
+ * unless the arena was created with MAVALLOC_GROW
  *
  * \return A pointer to the available memory or NULL if no free block is found 
  **/
 void * mavalloc_alloc( size_t size );
 
 
+/**
+ * @brief Allocate zeroed memory from the arena
+ *
+ * This function allocates n * size bytes like mavalloc_alloc and sets
+ * them to zero. Pages that were purged by mavalloc_purge already read as
+ * zero and are not cleared again.
+ *
+ * \param n The number of elements
+ * \param size The size of each element in bytes
+ * \return A pointer to the zeroed memory or NULL if no free block is found
+ **/
+void * mavalloc_calloc( size_t n, size_t size );
+
+
+/**
+ * @brief Allocate aligned memory from the arena
+ *
+ * This function allocates size bytes like mavalloc_alloc, starting at a
+ * multiple of align. The search asks for a hole of size + align - 4
+ * bytes so the block can be aligned inside it, and the bytes in front of
+ * the block stay a hole.
+ *
+ * \param size The number of bytes to allocate
+ * \param align The alignment in bytes, a power of two
+ * \return A pointer to the aligned memory or NULL if align is not a power
+ * of two or no free block is found
+ **/
+void * mavalloc_alloc_aligned( size_t size, size_t align );
+
+
+/**
+ * @brief Allocate a batch of equally sized blocks from the arena
+ *
+ * This function allocates n blocks of size bytes each and stores their
+ * addresses in out. The arena is searched once, using the heap algorithm
+ * specified when the arena was allocated, for a hole that can hold the
+ * whole batch. The blocks are then carved back to back from that hole.
+ *
+ * If no single hole can hold the batch the blocks are allocated one at a
+ * time until the arena runs out of space. Entries of out past the
+ * returned count are set to NULL.
+ *
+ * \param n The number of blocks to allocate
+ * \param size The size of each block in bytes
+ * \param out Array of at least n pointers that receives the blocks
+ * \return The number of blocks allocated
+ **/
+size_t mavalloc_alloc_batch( size_t n, size_t size, void **out );
+
+
+/*
+ * \brief Set the large object threshold
+ *
+ * with MAVALLOC_LARGE, allocations of at least bytes bytes are mapped on
+ * their own. the threshold goes back to 256 KB on mavalloc_destroy
+ *
+ * \param bytes the smallest allocation to map on its own
+ *
+ * \return none
+ */
+void mavalloc_set_large_threshold( size_t bytes );
+
 /*
  * \brief free the pointer
  *
@@ -89,6 +306,329 @@ void * mavalloc_alloc( size_t size );
  */
 void mavalloc_free(void *ptr);
 
+/*
+ * \brief free the pointer if the arena handed it out
+ *
+ * frees ptr like mavalloc_free and tells whether it was a block of the
+ * arena, in one lookup. for callers that mix the arena with another
+ * allocator and have to pass the pointers it does not own on
+ *
+ * \param ptr the memory to free
+ *
+ * \return 1 if ptr was freed, 0 if it is not a live block of the arena
+ */
+int mavalloc_free_owned( void * ptr );
+
+/*
+ * \brief free the pointer, given its size
+ *
+ * frees the memory block pointed to by pointer like mavalloc_free. with
+ * MAVALLOC_LARGE, a size below the large object threshold skips the scan
+ * of the large objects and goes straight to the ledger. the block is
+ * still looked up by its address, so a wrong size frees the right block,
+ * and instrumented builds count it in sized_free_mismatches
+ *
+ * \param ptr the heap memory to free
+ * \param size the size passed to mavalloc_alloc for ptr
+ *
+ * \return none
+ */
+void mavalloc_free_sized( void * ptr, size_t size );
+
+/*
+ * \brief size of an allocation
+ *
+ * returns how many bytes the block at ptr really holds, at least the size
+ * it was allocated with. pointers that were not returned by the arena,
+ * or were freed since, have a size of 0
+ *
+ * \param ptr the heap memory
+ *
+ * \return the usable size of the block or 0
+ */
+size_t mavalloc_usable_size( void * ptr );
+
+/*
+ * \brief free a batch of pointers
+ *
+ * frees every block in ptrs. The pointers are sorted by address and
+ * released in a single pass over the arena, coalescing each block with
+ * its free neighbours as it goes. NULL entries and pointers that were
+ * not returned by the allocator are ignored
+ *
+ * \param ptrs the heap memory to free
+ * \param n the number of entries in ptrs
+ *
+ * \return none
+ */
+void mavalloc_free_batch( void **ptrs, size_t n );
+
+/*
+ * \brief Set the purge decay time
+ *
+ * holes that have been free for at least ms milliseconds have their
+ * pages returned to the OS. while a decay time is set the free functions
+ * run a purge pass at most once per decay period. a negative value turns
+ * purging off, which is the default
+ *
+ * \param ms the decay time in milliseconds, or -1
+ *
+ * \return none
+ */
+void mavalloc_set_decay( long ms );
+
+/*
+ * \brief Purge holes older than the decay time
+ *
+ * releases the page aligned interior of every hole that has been free
+ * for at least the decay time with madvise(MADV_DONTNEED), so it reads
+ * back as zero. a hole at the end of a chunk mapped by MAVALLOC_GROW is
+ * unmapped instead, and a chunk that is entirely free is unmapped whole
+ *
+ * \return the number of bytes purged
+ */
+size_t mavalloc_purge( );
+
+/*
+ * \brief Allocate a relocatable block
+ *
+ * allocates size bytes like mavalloc_alloc but returns a handle instead
+ * of an address. blocks allocated through handles may be moved by
+ * mavalloc_compact while they are not pinned
+ *
+ * \param size the size of the block in bytes
+ *
+ * \return a handle, or -1 if the arena is out of space
+ */
+int mavalloc_halloc( size_t size );
+
+/*
+ * \brief Pin a handle
+ *
+ * pins may nest. the address stays valid until the matching
+ * mavalloc_hunpin, after that compaction may move the block
+ *
+ * \param handle a handle returned by mavalloc_halloc
+ *
+ * \return the current address of the block, or NULL for a bad handle
+ */
+void * mavalloc_hpin( int handle );
+
+/*
+ * \brief Unpin a handle pinned with mavalloc_hpin
+ *
+ * \param handle a handle returned by mavalloc_halloc
+ *
+ * \return none
+ */
+void mavalloc_hunpin( int handle );
+
+/*
+ * \brief free a handle and its block
+ *
+ * \param handle a handle returned by mavalloc_halloc
+ *
+ * \return none
+ */
+void mavalloc_hfree( int handle );
+
+/*
+ * \brief Compact the arena
+ *
+ * slides unpinned handle blocks towards the start of their chunk, merging
+ * the holes between them into one hole behind them. blocks returned by
+ * mavalloc_alloc and pinned blocks never move, holes in front of them
+ * stay. with a max_bytes other than 0 at most max_bytes are copied per
+ * call, or one block if the first block to move is larger than that, so
+ * the pause is bounded and compaction can be spread over several calls
+ *
+ * \param max_bytes the most bytes to move, or 0 to compact fully
+ *
+ * \return the number of bytes moved, 0 once there is nothing left to move
+ */
+size_t mavalloc_compact( size_t max_bytes );
+
+/*
+ * \brief Set the root block
+ *
+ * records ptr as the root of the data kept in the arena. for a file
+ * backed arena the root is stored in the file and is how a reopened heap
+ * finds its data again. the root is cleared when its block is freed
+ *
+ * \param ptr a block returned by the allocator, or NULL to clear the root
+ *
+ * \return none
+ */
+void mavalloc_set_root( void * ptr );
+
+/*
+ * \brief Get the root block
+ *
+ * \return the block set with mavalloc_set_root or NULL
+ */
+void * mavalloc_get_root( );
+
+/*
+ * \brief Offset of a pointer into the pool
+ *
+ * offsets stay valid when a file backed arena is mapped at a different
+ * address, so pointers stored inside the heap should be stored as offsets
+ *
+ * \param ptr an address inside the pool
+ *
+ * \return the offset of ptr from the start of the pool, or SIZE_MAX if
+ * ptr is not in the pool
+ */
+size_t mavalloc_offset( void * ptr );
+
+/*
+ * \brief Pointer for an offset into the pool
+ *
+ * \param offset an offset returned by mavalloc_offset
+ *
+ * \return the address at offset in the pool, or NULL if it is out of range
+ */
+void * mavalloc_pointer( size_t offset );
+
+/*
+ * \brief Current algorithm
+ *
+ * \return the algorithm searches use right now. the one the arena was
+ * initialized with, or the one ADAPTIVE currently picks
+ */
+enum ALGORITHM mavalloc_algorithm( );
+
+/*
+ * \brief Allocator statistics
+ *
+ * filled in by mavalloc_stats. blocks sitting in MAVALLOC_QUICKFIT bins
+ * count as neither allocated nor free, and MAVALLOC_LARGE objects are
+ * not part of the arena
+ */
+struct mavalloc_stats
+{
+  size_t bytes_allocated; // bytes in live blocks
+  size_t bytes_free; // bytes in holes
+  size_t holes;
+  size_t live_blocks;
+  size_t largest_hole; // size of the largest hole in bytes
+  double fragmentation; // share of the free bytes outside the largest hole
+  size_t high_water; // most bytes_allocated has been since init
+};
+
+/*
+ * \brief Get allocator statistics
+ *
+ * the statistics are kept up to date by every allocation and free, so
+ * this takes constant time and is cheap enough to call on a hot path
+ *
+ * \param stats receives the statistics
+ *
+ * \return none
+ */
+void mavalloc_stats( struct mavalloc_stats *stats );
+
+// buckets in a mavalloc_search_counters histogram
+#define MAVALLOC_HISTOGRAM_BUCKETS 32
+
+/*
+ * \brief Search counters of one algorithm
+ *
+ * visits is a histogram of the nodes each search visited: bucket 0
+ * counts searches that found a hole at the first node, bucket b > 0
+ * those that visited [2^(b-1), 2^b) nodes. the last bucket also takes
+ * everything above it
+ */
+struct mavalloc_search_counters
+{
+  unsigned long searches;
+  unsigned long nodes_visited;
+  unsigned long failures; // searches that found no hole
+  unsigned long visits[MAVALLOC_HISTOGRAM_BUCKETS];
+};
+
+/*
+ * \brief Instrumentation counters
+ *
+ * algorithm is indexed by enum ALGORITHM. searches of an ADAPTIVE arena
+ * count under the algorithm they used
+ */
+struct mavalloc_counters
+{
+  struct mavalloc_search_counters algorithm[ADAPTIVE];
+  unsigned long splits; // holes split to carve a block off them
+  unsigned long forward_coalesces; // frees merged with the hole after them
+  unsigned long backward_coalesces; // frees merged with the hole before them
+  unsigned long failed_allocations;
+  // mavalloc_free_sized calls with a size larger than the block
+  unsigned long sized_free_mismatches;
+};
+
+/*
+ * \brief Get the instrumentation counters
+ *
+ * the counters are only kept when the library is built with
+ * MAVALLOC_INSTRUMENT defined (make INSTRUMENT=1). otherwise the hot
+ * paths carry no instrumentation at all and this fills out with zeros.
+ * the counters cover every arena since the last reset
+ *
+ * \param out receives the counters
+ *
+ * \return 0, or -1 if the library was built without instrumentation
+ */
+int mavalloc_counters( struct mavalloc_counters *out );
+
+/*
+ * \brief Zero the instrumentation counters
+ *
+ * \return none
+ */
+void mavalloc_reset_counters( );
+
+/*
+ * \brief Start tracing allocations
+ *
+ * from now on every mavalloc_alloc, mavalloc_calloc, mavalloc_alloc_batch,
+ * mavalloc_halloc, mavalloc_hfree and free is recorded with its time,
+ * size, block offset, ledger index and search length in the format of
+ * mavalloc_trace.h, and every block mavalloc_compact moves as a free and
+ * an allocation. each thread buffers its records and appends them to path
+ * in batches, when its buffer fills, when it exits and on
+ * mavalloc_trace_stop. a thread's buffer is only touched by that thread,
+ * so tracing adds no locking to the hot path. tracing covers every arena
+ * until it is stopped
+ *
+ * \param path the trace file, truncated if it exists
+ *
+ * \return 0 on success, -1 if the file cannot be written or a trace is
+ * already running
+ */
+int mavalloc_trace_start( const char *path );
+
+/*
+ * \brief Stop tracing and flush every thread's records
+ *
+ * must not run while other threads are still allocating
+ *
+ * \return none
+ */
+void mavalloc_trace_stop( );
+
+/*
+ * \brief Fork handlers for pthread_atfork
+ *
+ * a fork while another thread holds the arena lock leaves the child with
+ * a lock nobody will release. mavalloc_fork_prepare takes the arena and
+ * trace locks before the fork, mavalloc_fork_parent releases them in the
+ * parent and mavalloc_fork_child resets them in the child. a shared heap
+ * keeps its lock across the fork, the parent releases it for both
+ *
+ * \return none
+ */
+void mavalloc_fork_prepare( );
+void mavalloc_fork_parent( );
+void mavalloc_fork_child( );
+
 /*
  * \brief Allocator size
  *
@@ -0,0 +1,195 @@
+// Replaces malloc and friends with a mavalloc arena, for running unmodified
+// programs on the allocator:
+//
+//   LD_PRELOAD=./libmavalloc_preload.so program
+//
+// The arena is created on the first allocation and configured from the
+// environment:
+//
+//   MAVALLOC_ARENA_SIZE  size of the initial pool in bytes, default 64 MB
+//   MAVALLOC_ALGORITHM   first, next, best, worst or adaptive, default next
+//   MAVALLOC_TRACE       path to record a trace of the program to
+//
+// The arena grows on demand and maps large objects on their own. When it
+// still cannot serve a request, for instance because the ledger is full,
+// the request falls through to glibc. Every pointer is checked against the
+// arena on the way back in, so blocks from either side are freed correctly.
+#define _GNU_SOURCE
+#include "mavalloc.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// malloc has to return memory aligned for any type. The pool and the
+// chunks start on a page, so rounding every size up to a multiple of 16
+// keeps every block 16 byte aligned
+#define MIN_ALIGN 16
+#define ROUND16(s) (((s) + MIN_ALIGN - 1) & ~(size_t) (MIN_ALIGN - 1))
+
+#define DEFAULT_ARENA_SIZE (64 * 1024 * 1024)
+
+#define EXPORT __attribute__((visibility("default")))
+
+// glibc's allocator, for what the arena cannot serve
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void __libc_free(void *ptr);
+
+static pthread_once_t arena_once = PTHREAD_ONCE_INIT;
+// set once the arena is up, everything goes to glibc otherwise
+static int arena_ready = 0;
+
+static enum ALGORITHM algorithm_from_env()
+{
+	const char *name = getenv("MAVALLOC_ALGORITHM");
+	if(name == NULL)
+		return NEXT_FIT;
+	if(strcmp(name, "first") == 0)
+		return FIRST_FIT;
+	if(strcmp(name, "best") == 0)
+		return BEST_FIT;
+	if(strcmp(name, "worst") == 0)
+		return WORST_FIT;
+	if(strcmp(name, "adaptive") == 0)
+		return ADAPTIVE;
+	return NEXT_FIT;
+}
+
+// the pool is mapped rather than malloc'd, malloc is us
+static void arena_create()
+{
+	const char *size = getenv("MAVALLOC_ARENA_SIZE");
+	size_t arena_size = size ? strtoull(size, NULL, 0) : DEFAULT_ARENA_SIZE;
+	int flags = MAVALLOC_MMAP | MAVALLOC_GROW | MAVALLOC_LARGE | MAVALLOC_QUICKFIT;
+	if(mavalloc_init_flags(arena_size, algorithm_from_env(), flags) != 0)
+		return;
+	// a fork while another thread allocates must not leave the child's
+	// arena locked
+	pthread_atfork(mavalloc_fork_prepare, mavalloc_fork_parent, mavalloc_fork_child);
+	const char *trace = getenv("MAVALLOC_TRACE");
+	if(trace != NULL)
+		mavalloc_trace_start(trace);
+	arena_ready = 1;
+}
+
+// threads buffer their trace records, write out what is left at exit
+__attribute__((destructor)) static void arena_exit()
+{
+	if(arena_ready)
+		mavalloc_trace_stop();
+}
+
+static int arena()
+{
+	pthread_once(&arena_once, arena_create);
+	return arena_ready;
+}
+
+// true if ptr was handed out by the arena, and its usable size in *size
+static int owned(void *ptr, size_t *size)
+{
+	*size = arena_ready ? mavalloc_usable_size(ptr) : 0;
+	return *size != 0;
+}
+
+EXPORT void *malloc(size_t size)
+{
+	void *ptr = NULL;
+	if(size <= SIZE_MAX - MIN_ALIGN && arena())
+		ptr = mavalloc_alloc(size ? ROUND16(size) : MIN_ALIGN);
+	return ptr ? ptr : __libc_malloc(size);
+}
+
+EXPORT void free(void *ptr)
+{
+	if(ptr == NULL)
+		return;
+	if(!arena_ready || !mavalloc_free_owned(ptr))
+		__libc_free(ptr);
+}
+
+EXPORT void *calloc(size_t n, size_t size)
+{
+	void *ptr = NULL;
+	if(size != 0 && n > SIZE_MAX / size)
+	{
+		errno = ENOMEM;
+		return NULL;
+	}
+	if(n * size <= SIZE_MAX - MIN_ALIGN && arena())
+		ptr = mavalloc_calloc(1, n * size != 0 ? ROUND16(n * size) : MIN_ALIGN);
+	return ptr ? ptr : __libc_calloc(n, size);
+}
+
+EXPORT void *realloc(void *ptr, size_t size)
+{
+	size_t old_size;
+	if(ptr == NULL)
+		return malloc(size);
+	if(size == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+	if(!owned(ptr, &old_size))
+		return __libc_realloc(ptr, size);
+	// blocks are never resized in place, shrinking keeps the block
+	if(size <= old_size)
+		return ptr;
+	void *moved = malloc(size);
+	if(moved == NULL)
+		return NULL;
+	memcpy(moved, ptr, old_size);
+	mavalloc_free_sized(ptr, old_size);
+	return moved;
+}
+
+// allocates size bytes at a multiple of align, a power of two
+static void *alloc_aligned(size_t align, size_t size)
+{
+	void *ptr = NULL;
+	if(align <= MIN_ALIGN)
+		return malloc(size);
+	if(size <= SIZE_MAX - MIN_ALIGN && arena())
+		ptr = mavalloc_alloc_aligned(size ? ROUND16(size) : MIN_ALIGN, align);
+	return ptr ? ptr : __libc_memalign(align, size);
+}
+
+EXPORT int posix_memalign(void **out, size_t align, size_t size)
+{
+	if(align % sizeof(void *) != 0 || (align & (align - 1)) != 0)
+		return EINVAL;
+	void *ptr = alloc_aligned(align, size);
+	if(ptr == NULL)
+		return ENOMEM;
+	*out = ptr;
+	return 0;
+}
+
+EXPORT void *aligned_alloc(size_t align, size_t size)
+{
+	if(align == 0 || (align & (align - 1)) != 0)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+	return alloc_aligned(align, size);
+}
+
+EXPORT size_t malloc_usable_size(void *ptr)
+{
+	static size_t (*libc_usable_size)(void *);
+	size_t size;
+	if(ptr == NULL)
+		return 0;
+	if(owned(ptr, &size))
+		return size;
+	if(libc_usable_size == NULL)
+		libc_usable_size = (size_t (*)(void *)) dlsym(RTLD_NEXT, "malloc_usable_size");
+	return libc_usable_size ? libc_usable_size(ptr) : 0;
+}
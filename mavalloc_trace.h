@@ -0,0 +1,52 @@
+// Binary format of the allocation traces written by mavalloc_trace_start
+//
+// A trace file is a struct mavalloc_trace_header followed by records.
+// Every thread buffers its own records and appends them to the file in
+// batches, so records are in time order within a thread but batches of
+// different threads interleave. Sort by timestamp for a global order.
+//
+// Handle allocations are recorded like any other. When mavalloc_compact
+// moves a handle's block the trace shows a free of the old block followed
+// by an allocation of the same size at the new offset.
+
+#ifndef MAVALLOC_TRACE_H
+#define MAVALLOC_TRACE_H
+
+#include <stdint.h>
+
+// "mavtrace" in ASCII
+#define MAVALLOC_TRACE_MAGIC 0x6563617274766176ULL
+#define MAVALLOC_TRACE_VERSION 1
+
+enum MAVALLOC_TRACE_OP
+{
+  MAVALLOC_TRACE_ALLOC = 0,
+  MAVALLOC_TRACE_FREE
+};
+
+// set in flags when an allocation returned NULL
+#define MAVALLOC_TRACE_FAILED 1
+
+struct mavalloc_trace_header
+{
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size; // sizeof(struct mavalloc_trace_record)
+};
+
+struct mavalloc_trace_record
+{
+  uint64_t timestamp_ns; // CLOCK_MONOTONIC
+  uint64_t size; // requested size of an allocation, block size of a free
+  // address of the block minus the base of the pool. Same as
+  // mavalloc_offset for blocks in the pool, and unique among live blocks
+  // for blocks in grown chunks and large objects as well
+  int64_t offset;
+  int32_t index; // ledger index of the block, -1 for large objects
+  uint32_t nodes_visited; // by the search for an allocation
+  uint32_t thread; // thread id of the caller
+  uint16_t op; // enum MAVALLOC_TRACE_OP
+  uint16_t flags;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "perf_counters.h"
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+const char *perf_event_names[PERF_EVENTS] = {
+	"cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses", "branch_misses"
+};
+
+// opens a counter for the calling process on any cpu, disabled until started
+static int perf_counter_open( uint32_t type, uint64_t config )
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	long fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	return fd < 0 ? -1 : (int) fd;
+}
+
+// config of a read miss in one of the PERF_TYPE_HW_CACHE caches
+static uint64_t read_miss( uint64_t cache )
+{
+	return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+// resets a counter to zero and starts counting, ignores -1
+static void perf_counter_start( int fd )
+{
+	if(fd == -1)
+		return;
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+}
+
+// stops a counter and returns what it counted since it was started, or -1
+static int64_t perf_counter_stop( int fd )
+{
+	uint64_t value;
+	if(fd == -1)
+		return -1;
+	ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+	if(read(fd, &value, sizeof(value)) != sizeof(value))
+		return -1;
+	return (int64_t) value;
+}
+
+static void perf_counter_close( int fd )
+{
+	if(fd != -1)
+		close(fd);
+}
+
+int perf_counters_open( struct perf_counters *pc )
+{
+	int opened = 0;
+	pc->fds[PERF_CYCLES] = perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+	pc->fds[PERF_INSTRUCTIONS] = perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+	pc->fds[PERF_L1D_MISSES] = perf_counter_open(PERF_TYPE_HW_CACHE, read_miss(PERF_COUNT_HW_CACHE_L1D));
+	pc->fds[PERF_LLC_MISSES] = perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+	pc->fds[PERF_DTLB_MISSES] = perf_counter_open(PERF_TYPE_HW_CACHE, read_miss(PERF_COUNT_HW_CACHE_DTLB));
+	pc->fds[PERF_BRANCH_MISSES] = perf_counter_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+	for(int i = 0; i < PERF_EVENTS; i++)
+	{
+		opened += pc->fds[i] != -1;
+	}
+	return opened;
+}
+
+void perf_counters_start( struct perf_counters *pc )
+{
+	for(int i = 0; i < PERF_EVENTS; i++)
+	{
+		perf_counter_start(pc->fds[i]);
+	}
+}
+
+void perf_counters_stop( struct perf_counters *pc, int64_t values[PERF_EVENTS] )
+{
+	for(int i = 0; i < PERF_EVENTS; i++)
+	{
+		values[i] = perf_counter_stop(pc->fds[i]);
+	}
+}
+
+void perf_counters_close( struct perf_counters *pc )
+{
+	for(int i = 0; i < PERF_EVENTS; i++)
+	{
+		perf_counter_close(pc->fds[i]);
+		pc->fds[i] = -1;
+	}
+}
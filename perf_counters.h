@@ -0,0 +1,61 @@
+// Hardware performance counters for the benchmarks
+//
+// Thin wrapper around perf_event_open(2). Counters that cannot be opened,
+// for example in containers or with a restrictive perf_event_paranoid,
+// read as -1 so the benchmarks still run without them.
+
+#include <stdint.h>
+
+// the events of a perf_counters set
+enum PERF_EVENT
+{
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_L1D_MISSES, // L1 data cache read misses
+  PERF_LLC_MISSES, // last level cache misses
+  PERF_DTLB_MISSES, // dTLB load misses
+  PERF_BRANCH_MISSES, // mispredicted branches
+  PERF_EVENTS
+};
+
+// names of the events, to label columns with
+extern const char *perf_event_names[PERF_EVENTS];
+
+// a counter for every event, -1 for those that are not available
+struct perf_counters
+{
+  int fds[PERF_EVENTS];
+};
+
+/**
+ * @brief Open a counter for every event of this thread
+ *
+ * Events the hardware or the kernel do not allow are left at -1, the
+ * others still count.
+ *
+ * \param pc The set to open
+ * \return The number of events that could be opened
+ **/
+int perf_counters_open( struct perf_counters *pc );
+
+/**
+ * @brief Reset every counter of a set to zero and start counting
+ *
+ * \param pc The set
+ **/
+void perf_counters_start( struct perf_counters *pc );
+
+/**
+ * @brief Stop every counter of a set and read their values
+ *
+ * \param pc The set
+ * \param values Receives a value per event, -1 for unavailable ones
+ **/
+void perf_counters_stop( struct perf_counters *pc, int64_t values[PERF_EVENTS] );
+
+/**
+ * @brief Close every counter of a set
+ *
+ * \param pc The set
+ **/
+void perf_counters_close( struct perf_counters *pc );
@@ -0,0 +1,374 @@
+// Replays recorded allocation traces against every algorithm and libc malloc
+//
+// usage: replay TRACE [ARENA_SIZE]
+//        replay --record TRACE
+//
+// The trace is mapped and its records are used in place. Frees are matched
+// to their allocations through the offsets in the trace, failed
+// allocations and frees of blocks allocated before the trace started are
+// skipped. Without ARENA_SIZE the arena is twice the most bytes the trace
+// ever has live. --record writes a trace of the parameters.h pattern that
+// bench -w pattern runs, to have something to replay.
+#include "mavalloc.h"
+#include "mavalloc_trace.h"
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "parameters.h"
+
+// operations between two footprint and fragmentation samples
+#define SAMPLE_EVERY 1024
+
+static const struct mavalloc_trace_record *records;
+static size_t num_records;
+// order to replay the records in, NULL if the file is already in time order
+static uint32_t *order;
+
+// open addressing map from trace offsets to the blocks replaying them
+static int64_t *map_keys;
+static void **map_blocks;
+static size_t map_mask;
+
+static long long *latency;
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int compare_ns(const void *a, const void *b)
+{
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+static int compare_time(const void *a, const void *b)
+{
+	uint64_t x = records[*(const uint32_t *)a].timestamp_ns;
+	uint64_t y = records[*(const uint32_t *)b].timestamp_ns;
+	return (x > y) - (x < y);
+}
+
+static const struct mavalloc_trace_record *record(size_t i)
+{
+	return &records[order ? order[i] : i];
+}
+
+static size_t map_slot(int64_t key)
+{
+	return (size_t)(((uint64_t)key * 0x9E3779B97F4A7C15ull) >> 20) & map_mask;
+}
+
+static void map_put(int64_t key, void *block)
+{
+	size_t i = map_slot(key);
+	while (map_blocks[i] != NULL && map_keys[i] != key)
+	{
+		i = (i + 1) & map_mask;
+	}
+	map_keys[i] = key;
+	map_blocks[i] = block;
+}
+
+// removes key and returns its block, or NULL if it is not in the map
+static void *map_take(int64_t key)
+{
+	size_t i = map_slot(key);
+	while (map_blocks[i] != NULL && map_keys[i] != key)
+	{
+		i = (i + 1) & map_mask;
+	}
+	void *block = map_blocks[i];
+	if (block == NULL)
+		return NULL;
+	map_blocks[i] = NULL;
+
+	// shift the entries of the probe run behind the hole back into it
+	size_t hole = i;
+	for (i = (i + 1) & map_mask; map_blocks[i] != NULL; i = (i + 1) & map_mask)
+	{
+		size_t home = map_slot(map_keys[i]);
+		if (((i - home) & map_mask) >= ((i - hole) & map_mask))
+		{
+			map_keys[hole] = map_keys[i];
+			map_blocks[hole] = map_blocks[i];
+			map_blocks[i] = NULL;
+			hole = i;
+		}
+	}
+	return block;
+}
+
+// maps the trace and checks its header, returns 0 on success
+static int load(const char *path)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct mavalloc_trace_header))
+	{
+		fprintf(stderr, "replay: cannot read %s\n", path);
+		return -1;
+	}
+	const char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+	const struct mavalloc_trace_header *header = (const void *)map;
+	if (header->magic != MAVALLOC_TRACE_MAGIC || header->version != MAVALLOC_TRACE_VERSION ||
+	    header->record_size != sizeof(struct mavalloc_trace_record))
+	{
+		fprintf(stderr, "replay: %s is not a mavalloc trace\n", path);
+		return -1;
+	}
+	records = (const void *)(map + sizeof(*header));
+	num_records = (st.st_size - sizeof(*header)) / sizeof(struct mavalloc_trace_record);
+
+	// threads flush their records in batches, put them back in time order
+	for (size_t i = 1; i < num_records; i++)
+	{
+		if (records[i].timestamp_ns < records[i - 1].timestamp_ns)
+		{
+			order = malloc(num_records * sizeof(uint32_t));
+			for (size_t k = 0; k < num_records; k++)
+			{
+				order[k] = k;
+			}
+			qsort(order, num_records, sizeof(uint32_t), compare_time);
+			break;
+		}
+	}
+	return 0;
+}
+
+// sizes the map for capacity entries, returns -1 if it cannot be allocated
+static int map_alloc(size_t capacity)
+{
+	free(map_keys);
+	free(map_blocks);
+	map_mask = capacity - 1;
+	map_keys = malloc(capacity * sizeof(int64_t));
+	map_blocks = calloc(capacity, sizeof(void *));
+	return map_keys == NULL || map_blocks == NULL ? -1 : 0;
+}
+
+// smallest power of two that keeps entries at most half of it
+static size_t map_capacity(size_t entries)
+{
+	size_t capacity = 16;
+	while (capacity < 2 * entries)
+		capacity *= 2;
+	return capacity;
+}
+
+// the most bytes the trace has live at once, and how many blocks. Free
+// records carry the block size rather than the requested one, so each
+// free is matched to its allocation by offset through the map, which has
+// to have room for every allocation of the trace
+static size_t peak_live(size_t *blocks)
+{
+	size_t live = 0;
+	size_t peak = 0;
+	size_t count = 0;
+	*blocks = 0;
+	for (size_t i = 0; i < num_records; i++)
+	{
+		const struct mavalloc_trace_record *r = record(i);
+		if (r->flags & MAVALLOC_TRACE_FAILED)
+			continue;
+		if (r->op == MAVALLOC_TRACE_ALLOC)
+		{
+			map_put(r->offset, (void *)r);
+			live += r->size;
+			count++;
+		}
+		else
+		{
+			const struct mavalloc_trace_record *alloc = map_take(r->offset);
+			if (alloc == NULL)
+				continue;
+			live -= alloc->size;
+			count--;
+		}
+		if (live > peak)
+			peak = live;
+		if (count > *blocks)
+			*blocks = count;
+	}
+	return peak;
+}
+
+// takes a sample of malloc's footprint, or of the arena's fragmentation.
+// The arena's footprint is tracked on every allocation instead
+static void sample(int libc, size_t *peak_footprint, double *fragmentation, int *samples)
+{
+	if (libc)
+	{
+		struct mallinfo2 info = mallinfo2();
+		if (info.arena + info.hblkhd > *peak_footprint)
+			*peak_footprint = info.arena + info.hblkhd;
+	}
+	else
+	{
+		struct mavalloc_stats stats;
+		mavalloc_stats(&stats);
+		*fragmentation += stats.fragmentation;
+		(*samples)++;
+	}
+}
+
+// replays the trace against an arena of the given algorithm, or against
+// malloc if libc is set, and prints one line of results
+static void run(const char *name, enum ALGORITHM algorithm, int libc, size_t arena_size)
+{
+	size_t ops = 0;
+	size_t failures = 0;
+	size_t peak_footprint = 0;
+	double fragmentation = 0.0;
+	int samples = 0;
+
+	if (!libc && mavalloc_init(arena_size, algorithm) != 0)
+	{
+		printf("%s: init failed\n", name);
+		return;
+	}
+	memset(map_blocks, 0, (map_mask + 1) * sizeof(void *));
+
+	long long start = now_ns();
+	for (size_t i = 0; i < num_records; i++)
+	{
+		const struct mavalloc_trace_record *r = record(i);
+		if (r->flags & MAVALLOC_TRACE_FAILED)
+			continue;
+
+		long long op_start = now_ns();
+		if (r->op == MAVALLOC_TRACE_ALLOC)
+		{
+			void *block = libc ? malloc(r->size) : mavalloc_alloc(r->size);
+			latency[ops++] = now_ns() - op_start;
+			if (block == NULL)
+			{
+				failures++;
+				continue;
+			}
+			map_put(r->offset, block);
+			if (!libc && mavalloc_offset(block) != SIZE_MAX && mavalloc_offset(block) + r->size > peak_footprint)
+				peak_footprint = mavalloc_offset(block) + r->size;
+		}
+		else
+		{
+			void *block = map_take(r->offset);
+			if (block == NULL)
+				continue;
+			op_start = now_ns();
+			if (libc)
+				free(block);
+			else
+				mavalloc_free(block);
+			latency[ops++] = now_ns() - op_start;
+		}
+
+		if (ops % SAMPLE_EVERY == 0)
+			sample(libc, &peak_footprint, &fragmentation, &samples);
+	}
+	double seconds = (now_ns() - start) / 1e9;
+	// traces shorter than a sample period still get one
+	if (ops % SAMPLE_EVERY != 0)
+		sample(libc, &peak_footprint, &fragmentation, &samples);
+
+	// release what the trace left allocated
+	for (size_t i = 0; i <= map_mask; i++)
+	{
+		if (map_blocks[i] != NULL && libc)
+			free(map_blocks[i]);
+	}
+	if (!libc)
+		mavalloc_destroy();
+
+	if (ops == 0)
+	{
+		printf("%s: nothing to replay\n", name);
+		return;
+	}
+	qsort(latency, ops, sizeof(long long), compare_ns);
+	printf("%s %.0lf %lld %lld %lld %zu %.3lf %zu\n", name, ops / seconds,
+	       latency[ops / 2], latency[(ops * 99) / 100], latency[ops - 1],
+	       peak_footprint / 1024, libc ? -1.0 : (samples ? fragmentation / samples : 0.0), failures);
+}
+
+// records the allocation pattern bench -w pattern runs into path
+static int record_default(const char *path)
+{
+	char *stuff[NUM_ALLOCS];
+	mavalloc_init(300000, FIRST_FIT);
+	if (mavalloc_trace_start(path) != 0)
+	{
+		fprintf(stderr, "replay: cannot write %s\n", path);
+		return 1;
+	}
+	for (int i = 0; i < NUM_ALLOCS; i++)
+	{
+		stuff[i] = mavalloc_alloc(sizeof(char) * 10);
+	}
+	for (int i = NUM_ALLOCS / 2; i < NUM_ALLOCS; i += 2)
+	{
+		mavalloc_free(stuff[i]);
+	}
+	for (int i = NUM_ALLOCS / 2; i < NUM_ALLOCS; i += 2)
+	{
+		stuff[i] = mavalloc_alloc(sizeof(char));
+	}
+	for (int i = 0; i < NUM_ALLOCS; i++)
+	{
+		mavalloc_free(stuff[i]);
+	}
+	mavalloc_trace_stop();
+	mavalloc_destroy();
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 3 && strcmp(argv[1], "--record") == 0)
+		return record_default(argv[2]);
+	if (argc < 2)
+	{
+		fprintf(stderr, "usage: %s TRACE [ARENA_SIZE]\n       %s --record TRACE\n", argv[0], argv[0]);
+		return 1;
+	}
+	if (load(argv[1]) != 0)
+		return 1;
+
+	// the map holds at most every allocation while the peak is measured,
+	// and the most blocks live at once while replaying
+	size_t allocs = 0;
+	for (size_t i = 0; i < num_records; i++)
+		allocs += records[i].op == MAVALLOC_TRACE_ALLOC;
+	size_t blocks;
+	if (map_alloc(map_capacity(allocs)) != 0)
+		return 1;
+	size_t peak = peak_live(&blocks);
+	size_t arena_size = argc > 2 ? strtoull(argv[2], NULL, 0) : 2 * peak + 4096;
+	latency = malloc((num_records + 1) * sizeof(long long));
+	if (map_alloc(map_capacity(blocks)) != 0 || latency == NULL)
+		return 1;
+
+	printf("# %zu records, %zu bytes live at peak, arena of %zu bytes\n", num_records, peak, arena_size);
+	printf("algorithm ops_per_sec p50_ns p99_ns max_ns peak_footprint_kb fragmentation failures\n");
+	run("first_fit", FIRST_FIT, 0, arena_size);
+	run("next_fit", NEXT_FIT, 0, arena_size);
+	run("best_fit", BEST_FIT, 0, arena_size);
+	run("worst_fit", WORST_FIT, 0, arena_size);
+	run("adaptive", ADAPTIVE, 0, arena_size);
+	run("libc", 0, 1, arena_size);
+	return 0;
+}
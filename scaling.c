@@ -0,0 +1,385 @@
+// Benchmarks how the allocators scale from 1 to N threads
+//
+// usage: scaling [-a ALLOCATOR] [-p PATTERN] [-T MAX_THREADS] [-n OPS]
+//                [-s SIZES] [-r REPETITIONS]
+//
+//   -a  first, next, best, worst, adaptive or all (default all), malloc
+//       always runs as the baseline
+//   -p  local, producer, shared or all (default all)
+//   -T  most threads, runs the powers of two up to it (default the number
+//       of CPUs, at least 4, at most 32)
+//   -n  allocations per thread (default 100000)
+//   -s  size distribution as in bench (default uniform:16:256)
+//   -r  repetitions per thread count, the best one is kept (default 3)
+//
+// The patterns:
+//   local     every thread allocates and frees its own blocks, a random
+//             lifetime workload from workload.h
+//   producer  the threads form a ring, each one passes the blocks it
+//             allocates to the next, which frees them
+//   shared    every thread swaps a block of its own for a random one of a
+//             table of shared blocks, writes to it and frees what it got
+//
+// For each thread count the throughput, the allocations that failed, the
+// scaling efficiency against one thread of the same allocator and the
+// throughput relative to malloc are printed as CSV.
+//
+// The arena ledger holds MAX_ALLOCS blocks and holes between all threads,
+// so the blocks each thread keeps live shrink as MAX_THREADS grows. They
+// are sized for the most threads of the run and kept for the smaller
+// counts, so every thread count does the same work per thread.
+#define _GNU_SOURCE
+#include "mavalloc.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+#define ARENA_SIZE (64 << 20)
+// entries of the arena ledger, MAX_ALLOCS in mavalloc.c. Every live block
+// may have a hole next to it, so at most half of them are live at once
+#define LEDGER_ENTRIES 10000
+#define LIVE_BUDGET (LEDGER_ENTRIES / 2)
+// most blocks each thread keeps live in the local pattern
+#define LOCAL_LIVE 256
+// most blocks in flight between two neighbours in the producer pattern
+#define RING_SIZE 256
+// blocks in the table of the shared pattern
+#define SHARED_SLOTS 2048
+#define MAX_THREADS 32
+#define MAX_REPETITIONS 100
+
+enum PATTERN
+{
+	LOCAL,
+	PRODUCER,
+	SHARED,
+	PATTERNS
+};
+
+static const char *pattern_names[] = { "local", "producer", "shared" };
+
+struct allocator
+{
+	const char *name;
+	int libc;
+	enum ALGORITHM algorithm;
+};
+
+static const struct allocator allocators[] = {
+	{ "malloc", 1, FIRST_FIT },
+	{ "first_fit", 0, FIRST_FIT },
+	{ "next_fit", 0, NEXT_FIT },
+	{ "best_fit", 0, BEST_FIT },
+	{ "worst_fit", 0, WORST_FIT },
+	{ "adaptive", 0, ADAPTIVE },
+};
+#define NUM_ALLOCATORS (int)(sizeof(allocators) / sizeof(allocators[0]))
+
+// single producer, single consumer queue of blocks
+struct ring
+{
+	void *blocks[RING_SIZE];
+	unsigned long head; // next to pop, written by the consumer
+	unsigned long tail; // next to push, written by the producer
+} __attribute__((aligned(64)));
+
+struct worker
+{
+	pthread_t thread;
+	int id;
+	struct workload workload; // the local pattern and the sizes of the others
+	size_t *sizes;
+	size_t num_sizes;
+	void **slots;
+	long ops;
+	long failures;
+	long long begin;
+	long long end;
+} __attribute__((aligned(64)));
+
+static struct workload_config config = { .sizes = SIZES_UNIFORM, .min = 16, .max = 256,
+                                          .lifetime = LIFETIME_RANDOM, .live = LOCAL_LIVE, .seed = 1 };
+static long allocations = 100000;
+// blocks in flight per ring, RING_SIZE or less for many threads
+static unsigned long ring_size = RING_SIZE;
+static int use_libc;
+static enum PATTERN pattern;
+static int num_threads;
+static pthread_barrier_t start;
+static struct ring rings[MAX_THREADS];
+static void *shared_slots[SHARED_SLOTS];
+static struct worker workers[MAX_THREADS];
+
+static long long now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *alloc_block(struct worker *w, size_t size)
+{
+	void *block = use_libc ? malloc(size) : mavalloc_alloc(size);
+	w->ops++;
+	if (block != NULL)
+		*(char *)block = 'x';
+	else
+		w->failures++;
+	return block;
+}
+
+// frees what a successful allocation returned, failed ones left NULL
+static void free_block(struct worker *w, void *block)
+{
+	if (block == NULL)
+		return;
+	if (use_libc)
+		free(block);
+	else
+		mavalloc_free(block);
+	if (w != NULL)
+		w->ops++;
+}
+
+static void run_local(struct worker *w)
+{
+	for (size_t k = 0; k < w->workload.count; k++)
+	{
+		const struct workload_op *op = &w->workload.ops[k];
+		if (op->op == WORKLOAD_ALLOC)
+		{
+			w->slots[op->slot] = alloc_block(w, op->size);
+		}
+		else
+		{
+			free_block(w, w->slots[op->slot]);
+			w->slots[op->slot] = NULL;
+		}
+	}
+}
+
+// pushes blocks to the next thread's ring and frees what the previous
+// thread pushed to ours, until both sides have seen every block
+static void run_producer(struct worker *w)
+{
+	struct ring *out = &rings[w->id];
+	struct ring *in = &rings[(w->id + num_threads - 1) % num_threads];
+	size_t produced = 0;
+	size_t consumed = 0;
+	while (produced < w->num_sizes || consumed < w->num_sizes)
+	{
+		int progress = 0;
+		unsigned long tail = out->tail;
+		if (produced < w->num_sizes && tail - __atomic_load_n(&out->head, __ATOMIC_ACQUIRE) < ring_size)
+		{
+			out->blocks[tail % RING_SIZE] = alloc_block(w, w->sizes[produced++]);
+			__atomic_store_n(&out->tail, tail + 1, __ATOMIC_RELEASE);
+			progress = 1;
+		}
+		unsigned long head = in->head;
+		if (head != __atomic_load_n(&in->tail, __ATOMIC_ACQUIRE))
+		{
+			free_block(w, in->blocks[head % RING_SIZE]);
+			__atomic_store_n(&in->head, head + 1, __ATOMIC_RELEASE);
+			consumed++;
+			progress = 1;
+		}
+		if (!progress)
+			sched_yield();
+	}
+}
+
+// swaps fresh blocks into random slots of the shared table and frees the
+// blocks other threads left there
+static void run_shared(struct worker *w)
+{
+	uint64_t random = w->id * 0x9E3779B97F4A7C15ULL + 1;
+	for (size_t k = 0; k < w->num_sizes; k++)
+	{
+		random ^= random << 13;
+		random ^= random >> 7;
+		random ^= random << 17;
+		void *block = alloc_block(w, w->sizes[k]);
+		void *old = __atomic_exchange_n(&shared_slots[random % SHARED_SLOTS], block, __ATOMIC_ACQ_REL);
+		if (old != NULL)
+		{
+			*(char *)old = 'y';
+			free_block(w, old);
+		}
+	}
+}
+
+static void *run_worker(void *arg)
+{
+	struct worker *w = arg;
+	pthread_barrier_wait(&start);
+	w->begin = now_ns();
+	if (pattern == LOCAL)
+		run_local(w);
+	else if (pattern == PRODUCER)
+		run_producer(w);
+	else
+		run_shared(w);
+	w->end = now_ns();
+	return NULL;
+}
+
+// runs one repetition on threads threads and returns the operations per
+// second, the allocations that failed go to *failures
+static double run_once(const struct allocator *a, int threads, long *failures)
+{
+	use_libc = a->libc;
+	num_threads = threads;
+	*failures = 0;
+	if (!use_libc && mavalloc_init(ARENA_SIZE, a->algorithm) != 0)
+		return -1.0;
+	memset(rings, 0, sizeof(rings));
+	memset(shared_slots, 0, sizeof(shared_slots));
+	pthread_barrier_init(&start, NULL, threads);
+	for (int t = 0; t < threads; t++)
+	{
+		workers[t].ops = 0;
+		workers[t].failures = 0;
+		pthread_create(&workers[t].thread, NULL, run_worker, &workers[t]);
+	}
+	long long begin = 0;
+	long long end = 0;
+	long ops = 0;
+	for (int t = 0; t < threads; t++)
+	{
+		pthread_join(workers[t].thread, NULL);
+		begin = t == 0 || workers[t].begin < begin ? workers[t].begin : begin;
+		end = workers[t].end > end ? workers[t].end : end;
+		ops += workers[t].ops;
+		*failures += workers[t].failures;
+	}
+	pthread_barrier_destroy(&start);
+
+	// the shared table outlives the threads
+	for (int i = 0; i < SHARED_SLOTS; i++)
+	{
+		if (shared_slots[i] != NULL)
+			free_block(NULL, shared_slots[i]);
+	}
+	if (!use_libc)
+		mavalloc_destroy();
+	return ops * 1e9 / (end - begin);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *allocator = "all";
+	const char *patterns = "all";
+	int repetitions = 3;
+	int max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (max_threads < 4)
+		max_threads = 4;
+	if (max_threads > MAX_THREADS)
+		max_threads = MAX_THREADS;
+	int opt;
+	while ((opt = getopt(argc, argv, "a:p:T:n:s:r:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a':
+				allocator = optarg;
+				break;
+			case 'p':
+				patterns = optarg;
+				break;
+			case 'T':
+				max_threads = atoi(optarg);
+				break;
+			case 'n':
+				allocations = atol(optarg);
+				break;
+			case 's':
+				if (workload_parse_sizes(optarg, &config) != 0)
+					max_threads = 0;
+				break;
+			case 'r':
+				repetitions = atoi(optarg);
+				break;
+			default:
+				max_threads = 0;
+		}
+	}
+	if (max_threads < 1 || max_threads > MAX_THREADS || allocations < 1 ||
+	    repetitions < 1 || repetitions > MAX_REPETITIONS)
+	{
+		fprintf(stderr, "usage: %s [-a ALLOCATOR] [-p PATTERN] [-T MAX_THREADS] [-n OPS]\n"
+		                "       [-s SIZES] [-r REPETITIONS]\n", argv[0]);
+		return 1;
+	}
+
+	// keep the live blocks of every thread within the ledger, the shared
+	// table takes its own share in the shared pattern
+	config.live = LIVE_BUDGET / max_threads < LOCAL_LIVE ? LIVE_BUDGET / max_threads : LOCAL_LIVE;
+	ring_size = LIVE_BUDGET / max_threads < RING_SIZE ? LIVE_BUDGET / max_threads : RING_SIZE;
+
+	// every thread gets its own seed, the local pattern replaces a block
+	// per allocation after filling its slots
+	config.replacements = allocations > config.live ? allocations - config.live : 0;
+	for (int t = 0; t < max_threads; t++)
+	{
+		config.seed = t + 1;
+		if (workload_generate(&config, &workers[t].workload) != 0)
+		{
+			fprintf(stderr, "scaling: invalid workload\n");
+			return 1;
+		}
+		workers[t].id = t;
+		workers[t].slots = calloc(workers[t].workload.slots, sizeof(void *));
+		workers[t].sizes = malloc(workers[t].workload.count * sizeof(size_t));
+		for (size_t k = 0; k < workers[t].workload.count; k++)
+		{
+			if (workers[t].workload.ops[k].op == WORKLOAD_ALLOC)
+				workers[t].sizes[workers[t].num_sizes++] = workers[t].workload.ops[k].size;
+		}
+	}
+
+	printf("allocator,pattern,threads,ops_per_sec,failures,efficiency,vs_malloc\n");
+	for (pattern = 0; pattern < PATTERNS; pattern++)
+	{
+		if (strcmp(patterns, "all") != 0 && strcmp(patterns, pattern_names[pattern]) != 0)
+			continue;
+		// indexed by log2 of the thread count
+		double baseline[8 * sizeof(int)];
+		for (int i = 0; i < NUM_ALLOCATORS; i++)
+		{
+			const struct allocator *a = &allocators[i];
+			if (!a->libc && strcmp(allocator, "all") != 0 && strncmp(allocator, a->name, strlen(allocator)) != 0)
+				continue;
+			double single = 0.0;
+			for (int threads = 1, step = 0; threads <= max_threads; threads *= 2, step++)
+			{
+				double best = 0.0;
+				long failures = 0;
+				for (int r = 0; r < repetitions; r++)
+				{
+					long rep_failures;
+					double ops_per_sec = run_once(a, threads, &rep_failures);
+					if (ops_per_sec > best)
+					{
+						best = ops_per_sec;
+						failures = rep_failures;
+					}
+				}
+				if (threads == 1)
+					single = best;
+				if (a->libc)
+					baseline[step] = best;
+				printf("%s,%s,%d,%.0f,%ld,%.3f,%.3f\n", a->name, pattern_names[pattern], threads, best,
+				       failures, best / (threads * single), best / baseline[step]);
+			}
+		}
+	}
+	return 0;
+}
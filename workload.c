@@ -0,0 +1,338 @@
+#include "workload.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// LIFETIME_LONG_TAIL picks the block that dies at rank u^LONG_TAIL_SKEW of
+// the live blocks, youngest first, so about one in twelve deaths falls in
+// the older half
+#define LONG_TAIL_SKEW 8
+
+// the live slots ordered by age, a ring of n slots starting at the oldest
+struct ages
+{
+	uint32_t *slot;
+	int size;
+	int head;
+	int n;
+};
+
+// generator state of one workload_generate call
+struct generator
+{
+	const struct workload_config *config;
+	struct workload *out;
+	uint64_t random;
+	double histogram_total;
+};
+
+// xorshift64* seeded through splitmix64, so every seed, 0 included, gives a
+// well mixed stream
+static void seed_random(struct generator *g, uint64_t seed)
+{
+	uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	g->random = (z ^ (z >> 31)) | 1;
+}
+
+static uint64_t next_random(struct generator *g)
+{
+	g->random ^= g->random >> 12;
+	g->random ^= g->random << 25;
+	g->random ^= g->random >> 27;
+	return g->random * 0x2545F4914F6CDD1DULL;
+}
+
+// uniform in [0, 1)
+static double next_uniform(struct generator *g)
+{
+	return (next_random(g) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static size_t draw_size(struct generator *g)
+{
+	const struct workload_config *c = g->config;
+	double u;
+	switch(c->sizes)
+	{
+		case SIZES_FIXED:
+			return c->min;
+		case SIZES_UNIFORM:
+			return c->min + next_random(g) % (c->max - c->min + 1);
+		case SIZES_POWER_LAW:
+		{
+			// inverse of the truncated power law's distribution function
+			double lo = (double) c->min;
+			double hi = (double) c->max + 1;
+			u = next_uniform(g);
+			double size;
+			if(fabs(c->alpha - 1.0) < 1e-9)
+				size = lo * pow(hi / lo, u);
+			else
+			{
+				double a = 1 - c->alpha;
+				size = pow(pow(lo, a) + u * (pow(hi, a) - pow(lo, a)), 1 / a);
+			}
+			if(size < lo)
+				return c->min;
+			return size >= c->max ? c->max : (size_t) size;
+		}
+		case SIZES_BIMODAL:
+			return next_uniform(g) < c->fraction ? c->max : c->min;
+		case SIZES_HISTOGRAM:
+			u = next_uniform(g) * g->histogram_total;
+			for(int i = 0; i < c->histogram_len - 1; i++)
+			{
+				if(u < c->histogram_weights[i])
+					return c->histogram_sizes[i];
+				u -= c->histogram_weights[i];
+			}
+			return c->histogram_sizes[c->histogram_len - 1];
+	}
+	return c->min;
+}
+
+// rank of the block that dies next among n live blocks, 0 is the youngest
+static int draw_rank(struct generator *g, int n)
+{
+	switch(g->config->lifetime)
+	{
+		case LIFETIME_LIFO:
+			return 0;
+		case LIFETIME_FIFO:
+			return n - 1;
+		case LIFETIME_LONG_TAIL:
+			return (int) (pow(next_uniform(g), LONG_TAIL_SKEW) * n);
+		default:
+			return next_random(g) % n;
+	}
+}
+
+static void push_young(struct ages *a, uint32_t slot)
+{
+	a->slot[(a->head + a->n) % a->size] = slot;
+	a->n++;
+}
+
+// removes the block of the given rank, moving whichever side of it is
+// shorter into the gap. returns its slot
+static uint32_t remove_rank(struct ages *a, int rank)
+{
+	int pos = a->n - 1 - rank;
+	uint32_t slot = a->slot[(a->head + pos) % a->size];
+	if(rank < pos)
+	{
+		for(int i = pos; i < a->n - 1; i++)
+		{
+			a->slot[(a->head + i) % a->size] = a->slot[(a->head + i + 1) % a->size];
+		}
+	}
+	else
+	{
+		for(int i = pos; i > 0; i--)
+		{
+			a->slot[(a->head + i) % a->size] = a->slot[(a->head + i - 1) % a->size];
+		}
+		a->head = (a->head + 1) % a->size;
+	}
+	a->n--;
+	return slot;
+}
+
+static void emit(struct generator *g, enum WORKLOAD_OP op, uint32_t slot)
+{
+	struct workload_op *o = &g->out->ops[g->out->count++];
+	o->op = op;
+	o->slot = slot;
+	o->size = op == WORKLOAD_ALLOC ? draw_size(g) : 0;
+}
+
+// the old benchmark loop: fill every slot, free every other block of the
+// second half, refill those and free everything
+static void generate_pattern(struct generator *g, int live)
+{
+	for(int i = 0; i < live; i++)
+	{
+		emit(g, WORKLOAD_ALLOC, i);
+	}
+	for(int i = live / 2; i < live; i += 2)
+	{
+		emit(g, WORKLOAD_FREE, i);
+	}
+	for(int i = live / 2; i < live; i += 2)
+	{
+		emit(g, WORKLOAD_ALLOC, i);
+	}
+	for(int i = 0; i < live; i++)
+	{
+		emit(g, WORKLOAD_FREE, i);
+	}
+}
+
+static int valid(const struct workload_config *c)
+{
+	if(c->live < 1 || c->replacements < 0)
+		return 0;
+	switch(c->sizes)
+	{
+		case SIZES_FIXED:
+			return c->min > 0;
+		case SIZES_UNIFORM:
+		case SIZES_POWER_LAW:
+			return c->min > 0 && c->min <= c->max;
+		case SIZES_BIMODAL:
+			return c->min > 0 && c->max > 0 && c->fraction >= 0 && c->fraction <= 1;
+		case SIZES_HISTOGRAM:
+			if(c->histogram_len < 1 || c->histogram_len > WORKLOAD_HISTOGRAM_MAX)
+				return 0;
+			for(int i = 0; i < c->histogram_len; i++)
+			{
+				if(c->histogram_sizes[i] == 0 || c->histogram_weights[i] < 0)
+					return 0;
+			}
+			return 1;
+	}
+	return 0;
+}
+
+int workload_generate( const struct workload_config *config, struct workload *out )
+{
+	struct generator g = { config, out, 0, 0.0 };
+	struct ages ages;
+	int live = config->live;
+
+	memset(out, 0, sizeof(*out));
+	if(!valid(config))
+		return -1;
+	seed_random(&g, config->seed);
+	for(int i = 0; i < config->histogram_len; i++)
+	{
+		g.histogram_total += config->histogram_weights[i];
+	}
+
+	size_t count = 2 * (size_t) live;
+	if(config->lifetime == LIFETIME_PATTERN)
+		count += 2 * (size_t) ((live - live / 2 + 1) / 2);
+	else
+		count += 2 * (size_t) config->replacements;
+	out->ops = malloc(count * sizeof(struct workload_op));
+	if(out->ops == NULL)
+		return -1;
+	out->slots = live;
+
+	if(config->lifetime == LIFETIME_PATTERN)
+	{
+		generate_pattern(&g, live);
+		return 0;
+	}
+
+	ages.slot = malloc(live * sizeof(uint32_t));
+	if(ages.slot == NULL)
+	{
+		workload_free(out);
+		return -1;
+	}
+	ages.size = live;
+	ages.head = 0;
+	ages.n = 0;
+
+	for(int i = 0; i < live; i++)
+	{
+		emit(&g, WORKLOAD_ALLOC, i);
+		push_young(&ages, i);
+	}
+	for(long r = 0; r < config->replacements; r++)
+	{
+		uint32_t slot = remove_rank(&ages, draw_rank(&g, ages.n));
+		emit(&g, WORKLOAD_FREE, slot);
+		emit(&g, WORKLOAD_ALLOC, slot);
+		push_young(&ages, slot);
+	}
+	// the survivors die in the order the lifetime distribution gives them
+	while(ages.n > 0)
+	{
+		emit(&g, WORKLOAD_FREE, remove_rank(&ages, draw_rank(&g, ages.n)));
+	}
+	free(ages.slot);
+	return 0;
+}
+
+void workload_free( struct workload *w )
+{
+	free(w->ops);
+	w->ops = NULL;
+	w->count = 0;
+}
+
+static int parse_histogram( const char *spec, struct workload_config *config )
+{
+	char *end;
+	config->histogram_len = 0;
+	while(*spec != '\0')
+	{
+		if(config->histogram_len == WORKLOAD_HISTOGRAM_MAX)
+			return -1;
+		size_t size = strtoull(spec, &end, 0);
+		if(end == spec || *end != '=')
+			return -1;
+		spec = end + 1;
+		double weight = strtod(spec, &end);
+		if(end == spec || (*end != ',' && *end != '\0'))
+			return -1;
+		config->histogram_sizes[config->histogram_len] = size;
+		config->histogram_weights[config->histogram_len] = weight;
+		config->histogram_len++;
+		spec = *end == ',' ? end + 1 : end;
+	}
+	return config->histogram_len > 0 ? 0 : -1;
+}
+
+int workload_parse_sizes( const char *spec, struct workload_config *config )
+{
+	int used = 0;
+	if(sscanf(spec, "fixed:%zu%n", &config->min, &used) == 1 && spec[used] == '\0')
+	{
+		config->sizes = SIZES_FIXED;
+		config->max = config->min;
+		return 0;
+	}
+	if(sscanf(spec, "uniform:%zu:%zu%n", &config->min, &config->max, &used) == 2 && spec[used] == '\0')
+	{
+		config->sizes = SIZES_UNIFORM;
+		return 0;
+	}
+	if(sscanf(spec, "powerlaw:%zu:%zu:%lf%n", &config->min, &config->max, &config->alpha, &used) == 3 &&
+		 spec[used] == '\0')
+	{
+		config->sizes = SIZES_POWER_LAW;
+		return 0;
+	}
+	if(sscanf(spec, "bimodal:%zu:%zu:%lf%n", &config->min, &config->max, &config->fraction, &used) == 3 &&
+		 spec[used] == '\0')
+	{
+		config->sizes = SIZES_BIMODAL;
+		return 0;
+	}
+	if(strncmp(spec, "histogram:", 10) == 0)
+	{
+		config->sizes = SIZES_HISTOGRAM;
+		return parse_histogram(spec + 10, config);
+	}
+	return -1;
+}
+
+int workload_parse_lifetime( const char *name, struct workload_config *config )
+{
+	static const char *names[] = { "lifo", "fifo", "random", "longtail", "pattern" };
+	for(int i = 0; i < (int) (sizeof(names) / sizeof(names[0])); i++)
+	{
+		if(strcmp(name, names[i]) == 0)
+		{
+			config->lifetime = i;
+			return 0;
+		}
+	}
+	return -1;
+}
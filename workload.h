@@ -0,0 +1,112 @@
+// Synthetic allocation workloads for the benchmarks and the unit tests
+//
+// A workload is generated up front as a sequence of operations on
+// numbered slots, so running it costs nothing but the allocations. The
+// sequence fills every slot, then repeatedly frees a block picked by the
+// lifetime distribution and allocates one with a size drawn from the
+// size distribution in its place, and finally frees everything left. The
+// same config and seed always give the same sequence.
+
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// most sizes in an empirical histogram
+#define WORKLOAD_HISTOGRAM_MAX 32
+
+enum WORKLOAD_SIZES
+{
+  SIZES_FIXED, // always min
+  SIZES_UNIFORM, // uniform in [min, max]
+  SIZES_POWER_LAW, // density proportional to size^-alpha in [min, max]
+  SIZES_BIMODAL, // max with probability fraction, min otherwise
+  SIZES_HISTOGRAM // histogram_sizes weighted by histogram_weights
+};
+
+enum WORKLOAD_LIFETIME
+{
+  LIFETIME_LIFO, // the youngest block dies first
+  LIFETIME_FIFO, // the oldest block dies first
+  LIFETIME_RANDOM, // any live block is equally likely to die
+  LIFETIME_LONG_TAIL, // mostly young blocks die, a few live very long
+  LIFETIME_PATTERN // the fixed sequence of the old parameters.h benchmarks
+};
+
+struct workload_config
+{
+  enum WORKLOAD_SIZES sizes;
+  size_t min;
+  size_t max;
+  double alpha; // SIZES_POWER_LAW
+  double fraction; // SIZES_BIMODAL
+  size_t histogram_sizes[WORKLOAD_HISTOGRAM_MAX];
+  double histogram_weights[WORKLOAD_HISTOGRAM_MAX];
+  int histogram_len;
+  enum WORKLOAD_LIFETIME lifetime;
+  int live; // blocks live once every slot is filled
+  long replacements; // frees followed by an allocation after filling
+  uint64_t seed;
+};
+
+enum WORKLOAD_OP
+{
+  WORKLOAD_ALLOC,
+  WORKLOAD_FREE
+};
+
+struct workload_op
+{
+  uint32_t op; // enum WORKLOAD_OP
+  uint32_t slot;
+  size_t size; // of an allocation
+};
+
+struct workload
+{
+  struct workload_op *ops;
+  size_t count;
+  int slots; // number of slots the operations refer to
+};
+
+/**
+ * @brief Generate the operations of a workload
+ *
+ * \param config The size and lifetime distributions, sizes and seed
+ * \param out Receives the operations, release them with workload_free
+ * \return 0 on success or -1 if the config is invalid or memory ran out
+ **/
+int workload_generate( const struct workload_config *config, struct workload *out );
+
+/**
+ * @brief Release the operations of a generated workload
+ *
+ * \param w The workload filled in by workload_generate
+ **/
+void workload_free( struct workload *w );
+
+/**
+ * @brief Parse a size distribution into a config
+ *
+ * Accepts fixed:N, uniform:MIN:MAX, powerlaw:MIN:MAX:ALPHA,
+ * bimodal:SMALL:LARGE:FRACTION and histogram:SIZE=WEIGHT,SIZE=WEIGHT,...
+ *
+ * \param spec The distribution
+ * \param config The config whose size fields are set
+ * \return 0 on success or -1 if spec is not understood
+ **/
+int workload_parse_sizes( const char *spec, struct workload_config *config );
+
+/**
+ * @brief Parse a lifetime distribution into a config
+ *
+ * Accepts lifo, fifo, random, longtail and pattern
+ *
+ * \param name The distribution
+ * \param config The config whose lifetime is set
+ * \return 0 on success or -1 if name is not understood
+ **/
+int workload_parse_lifetime( const char *name, struct workload_config *config );
+
+#endif